@@ -0,0 +1,275 @@
+/*
+ * client-conns.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+
+#include "client-conns.h"
+
+// epoll events handled per epoll_wait()
+#define MAX_EVENTS 64
+
+// how long to stop accepting after accept() failed, e.g. for want of
+// file descriptors
+#define ACCEPT_PAUSE_MS 1000
+
+static long long nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void unlinkIdle(struct ClientConns *conns, struct ClientConn *conn)
+{
+    if(conn->prev)
+        conn->prev->next = conn->next;
+    else
+        conns->idleHead = conn->next;
+    if(conn->next)
+        conn->next->prev = conn->prev;
+    else
+        conns->idleTail = conn->prev;
+}
+
+/*
+ * add conn to the end of the idle list and (re)arm it in the epoll set
+ * op is EPOLL_CTL_ADD for a new connection, EPOLL_CTL_MOD otherwise
+*/
+static void park(struct ClientConns *conns, struct ClientConn *conn, int op)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = conn;
+
+    // under the lock, so that the poller can't see it readable before
+    // it is on the list
+    pthread_mutex_lock(&conns->lock);
+    conn->idleSince = nowMs();
+    conn->prev = conns->idleTail;
+    conn->next = NULL;
+    if(conns->idleTail)
+        conns->idleTail->next = conn;
+    else
+        conns->idleHead = conn;
+    conns->idleTail = conn;
+
+    if(epoll_ctl(conns->epollFd, op, conn->sock, &ev) < 0) {
+        perror("epoll_ctl() failed");
+        unlinkIdle(conns, conn);
+        pthread_mutex_unlock(&conns->lock);
+        closeClientConn(conns, conn);
+        return;
+    }
+    pthread_mutex_unlock(&conns->lock);
+}
+
+static void pauseAccepting(struct ClientConns *conns)
+{
+    struct epoll_event ev;
+    ev.events = 0;
+    ev.data.ptr = NULL;
+    epoll_ctl(conns->epollFd, EPOLL_CTL_MOD, conns->servSock, &ev);
+    conns->acceptPausedUntil = nowMs() + ACCEPT_PAUSE_MS;
+}
+
+static void resumeAccepting(struct ClientConns *conns)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(conns->epollFd, EPOLL_CTL_MOD, conns->servSock, &ev);
+    conns->acceptPausedUntil = 0;
+}
+
+/*
+ * accept every pending connection and park it until its first request
+*/
+static void acceptConns(struct ClientConns *conns)
+{
+    // the idle timeout also bounds every read within a request
+    struct timeval tv;
+    tv.tv_sec = conns->idleTimeout;
+    tv.tv_usec = 0;
+
+    for(;;) {
+        struct sockaddr_in addr;
+        socklen_t addrLen = sizeof(addr);
+        int sock = accept(conns->servSock, (struct sockaddr *)&addr, &addrLen);
+        if(sock < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // e.g. out of file descriptors; don't take the server down
+            perror("accept() failed");
+            pauseAccepting(conns);
+            return;
+        }
+
+        if(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+            perror("setsockopt() failed");
+
+        struct ClientConn *conn =
+            (struct ClientConn *)calloc(1, sizeof(struct ClientConn));
+        if(conn == NULL || (conn->fp = fdopen(sock, "r")) == NULL) {
+            perror("fdopen() failed");
+            close(sock);
+            free(conn);
+            continue;
+        }
+        conn->sock = sock;
+        conn->addr = addr;
+        atomic_fetch_add_explicit(&conns->open, 1, memory_order_relaxed);
+        park(conns, conn, EPOLL_CTL_ADD);
+    }
+}
+
+/*
+ * hand a parked connection that has become readable to the workers
+*/
+static void wakeConn(struct ClientConns *conns, struct ClientConn *conn)
+{
+    pthread_mutex_lock(&conns->lock);
+    unlinkIdle(conns, conn);
+    conn->next = NULL;
+    if(conns->readyTail)
+        conns->readyTail->next = conn;
+    else
+        conns->readyHead = conn;
+    conns->readyTail = conn;
+    pthread_cond_signal(&conns->readyCond);
+    pthread_mutex_unlock(&conns->lock);
+}
+
+/*
+ * close the connections that have been parked for too long
+ * returns how many milliseconds until the next one is due
+*/
+static int expireConns(struct ClientConns *conns)
+{
+    long long now = nowMs();
+    long long limit = (long long)conns->idleTimeout * 1000;
+    struct ClientConn *expired = NULL;
+
+    pthread_mutex_lock(&conns->lock);
+    while(conns->idleHead && now - conns->idleHead->idleSince >= limit) {
+        struct ClientConn *conn = conns->idleHead;
+        unlinkIdle(conns, conn);
+        conn->next = expired;
+        expired = conn;
+    }
+    // one parked after this returns is due no sooner than a full
+    // timeout from now, so the poller never sleeps past it
+    long long wait = conns->idleHead ?
+        conns->idleHead->idleSince + limit - now : limit;
+    pthread_mutex_unlock(&conns->lock);
+
+    while(expired) {
+        struct ClientConn *next = expired->next;
+        closeClientConn(conns, expired);
+        expired = next;
+    }
+    return (int)wait;
+}
+
+/*
+ * the poller thread: accept new connections, wake up parked ones
+ * that become readable and close the ones idle for too long
+*/
+static void *pollConns(void *arg)
+{
+    struct ClientConns *conns = (struct ClientConns *)arg;
+    struct epoll_event events[MAX_EVENTS];
+    int timeout = conns->idleTimeout * 1000;
+
+    for(;;) {
+        if(conns->acceptPausedUntil) {
+            long long left = conns->acceptPausedUntil - nowMs();
+            if(left <= 0)
+                resumeAccepting(conns);
+            else if(left < timeout)
+                timeout = (int)left;
+        }
+
+        int n = epoll_wait(conns->epollFd, events, MAX_EVENTS, timeout);
+        if(n < 0 && errno != EINTR)
+            perror("epoll_wait() failed");
+
+        int i;
+        for(i = 0; i < n; i++) {
+            if(events[i].data.ptr == NULL)
+                acceptConns(conns);
+            else
+                wakeConn(conns, (struct ClientConn *)events[i].data.ptr);
+        }
+
+        // after the events, none of which can then be for a closed one
+        timeout = expireConns(conns);
+    }
+    return NULL;
+}
+
+int initClientConns(struct ClientConns *conns, int servSock, int idleTimeout)
+{
+    memset(conns, 0, sizeof(*conns));
+    conns->servSock = servSock;
+    conns->idleTimeout = idleTimeout;
+    atomic_init(&conns->open, 0);
+    pthread_mutex_init(&conns->lock, NULL);
+    pthread_cond_init(&conns->readyCond, NULL);
+
+    // the poller accepts until there are no more connections pending
+    int flags = fcntl(servSock, F_GETFL);
+    if(flags < 0 || fcntl(servSock, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+
+    if((conns->epollFd = epoll_create1(0)) < 0)
+        return -1;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if(epoll_ctl(conns->epollFd, EPOLL_CTL_ADD, servSock, &ev) < 0)
+        return -1;
+
+    pthread_t tid;
+    if(pthread_create(&tid, NULL, &pollConns, conns) != 0)
+        return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+struct ClientConn *takeClientConn(struct ClientConns *conns)
+{
+    pthread_mutex_lock(&conns->lock);
+    while(conns->readyHead == NULL)
+        pthread_cond_wait(&conns->readyCond, &conns->lock);
+    struct ClientConn *conn = conns->readyHead;
+    conns->readyHead = conn->next;
+    if(conns->readyHead == NULL)
+        conns->readyTail = NULL;
+    pthread_mutex_unlock(&conns->lock);
+    return conn;
+}
+
+void parkClientConn(struct ClientConns *conns, struct ClientConn *conn)
+{
+    park(conns, conn, EPOLL_CTL_MOD);
+}
+
+void closeClientConn(struct ClientConns *conns, struct ClientConn *conn)
+{
+    // closes the socket too, which takes it out of the epoll set
+    fclose(conn->fp);
+    free(conn);
+    atomic_fetch_sub_explicit(&conns->open, 1, memory_order_relaxed);
+}
@@ -0,0 +1,76 @@
+/*
+ * client-conns.h
+*/
+
+#ifndef _CLIENT_CONNS_H_
+#define _CLIENT_CONNS_H_
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+
+/*
+ * an open client connection
+*/
+struct ClientConn {
+    int sock;
+    FILE *fp;               // for reading requests from sock
+    struct sockaddr_in addr;
+    int requests;           // answered so far
+
+    // while it is parked or waiting for a worker
+    long long idleSince;    // milliseconds, on CLOCK_MONOTONIC
+    struct ClientConn *prev;
+    struct ClientConn *next;
+};
+
+/*
+ * the client connections that no worker is serving
+ *
+ * a connection between requests is parked in an epoll set instead of
+ * keeping a worker blocked in recv().  a thread of its own accepts new
+ * connections, parks them too, and moves each parked connection that
+ * becomes readable to the ready queue, from which the workers take
+ * them.  a connection that stays parked for longer than the idle
+ * timeout is closed.
+*/
+struct ClientConns {
+    int servSock;
+    int epollFd;
+    int idleTimeout;        // seconds
+    atomic_long open;       // connections, parked or not
+    long long acceptPausedUntil;    // after accept() failed; 0 if not
+
+    pthread_mutex_t lock;
+    pthread_cond_t readyCond;
+
+    // protected by lock
+    struct ClientConn *idleHead;    // parked, oldest first
+    struct ClientConn *idleTail;
+    struct ClientConn *readyHead;   // readable, oldest first
+    struct ClientConn *readyTail;
+};
+
+/*
+ * start accepting connections on the listening socket servSock
+ * returns 0 on success, -1 on failure
+*/
+int initClientConns(struct ClientConns *conns, int servSock, int idleTimeout);
+
+/*
+ * wait for a connection with a request (or its end) to read
+*/
+struct ClientConn *takeClientConn(struct ClientConns *conns);
+
+/*
+ * park a connection until its next request arrives
+*/
+void parkClientConn(struct ClientConns *conns, struct ClientConn *conn);
+
+/*
+ * close a connection taken with takeClientConn()
+*/
+void closeClientConn(struct ClientConns *conns, struct ClientConn *conn);
+
+#endif /* _CLIENT_CONNS_H_ */
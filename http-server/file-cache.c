@@ -0,0 +1,221 @@
+/*
+ * file-cache.c
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "file-cache.h"
+
+// a single file may take up at most this fraction of the budget
+#define MAX_FILE_FRACTION 8
+
+// bytes of budget per hash bucket
+#define BYTES_PER_BUCKET 4096
+
+// seconds a copy is served without looking at the file
+#define CHECK_INTERVAL 1
+
+int initFileCache(struct FileCache *cache, size_t budget)
+{
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    if(budget == 0)
+        return 0;
+
+    size_t n = 64;
+    while(n < budget / BYTES_PER_BUCKET)
+        n *= 2;
+    cache->buckets = (struct CachedFile **)calloc(n, sizeof(struct CachedFile *));
+    if(cache->buckets == NULL)
+        return -1;
+    cache->nbuckets = n;
+    cache->budget = budget;
+    return 0;
+}
+
+size_t fileCacheMaxFile(struct FileCache *cache)
+{
+    return cache->budget / MAX_FILE_FRACTION;
+}
+
+static struct CachedFile **findSlot(struct FileCache *cache, const char *path)
+{
+    // FNV-1a
+    size_t h = 2166136261u;
+    const char *p;
+    for(p = path; *p; p++) {
+        h ^= (unsigned char)*p;
+        h *= 16777619u;
+    }
+
+    struct CachedFile **slot = &cache->buckets[h & (cache->nbuckets - 1)];
+    while(*slot && strcmp((*slot)->path, path) != 0)
+        slot = &(*slot)->hashNext;
+    return slot;
+}
+
+static void lruUnlink(struct FileCache *cache, struct CachedFile *file)
+{
+    if(file->lruPrev)
+        file->lruPrev->lruNext = file->lruNext;
+    else
+        cache->lruHead = file->lruNext;
+    if(file->lruNext)
+        file->lruNext->lruPrev = file->lruPrev;
+    else
+        cache->lruTail = file->lruPrev;
+}
+
+static void lruPushFront(struct FileCache *cache, struct CachedFile *file)
+{
+    file->lruPrev = NULL;
+    file->lruNext = cache->lruHead;
+    if(cache->lruHead)
+        cache->lruHead->lruPrev = file;
+    else
+        cache->lruTail = file;
+    cache->lruHead = file;
+}
+
+static void freeFile(struct CachedFile *file)
+{
+    free(file->path);
+    free(file->headers);
+    free(file->data);
+    free(file);
+}
+
+/*
+ * take file out of the cache; it is freed once the requests still
+ * sending it are done
+ * called with the lock held
+*/
+static void removeFile(struct FileCache *cache, struct CachedFile *file)
+{
+    *findSlot(cache, file->path) = file->hashNext;
+    lruUnlink(cache, file);
+    cache->bytes -= file->size;
+    if(--file->refs == 0)
+        freeFile(file);
+}
+
+/*
+ * mark file as just used and take a reference for the caller
+ * called with the lock held
+*/
+static struct CachedFile *useFile(struct FileCache *cache, struct CachedFile *file)
+{
+    cache->hits++;
+    lruUnlink(cache, file);
+    lruPushFront(cache, file);
+    file->refs++;
+    return file;
+}
+
+struct CachedFile *findCachedFile(struct FileCache *cache, const char *path)
+{
+    if(cache->nbuckets == 0)
+        return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    struct CachedFile *file = *findSlot(cache, path);
+    if(file && time(NULL) - file->checked < CHECK_INTERVAL)
+        file = useFile(cache, file);
+    else
+        file = NULL;
+    pthread_mutex_unlock(&cache->lock);
+    return file;
+}
+
+struct CachedFile *validateCachedFile(struct FileCache *cache,
+        const char *path, const struct stat *st)
+{
+    if(cache->nbuckets == 0)
+        return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    struct CachedFile *file = *findSlot(cache, path);
+    if(file) {
+        if(st && file->dev == st->st_dev && file->ino == st->st_ino &&
+                file->size == st->st_size &&
+                file->mtime.tv_sec == st->st_mtim.tv_sec &&
+                file->mtime.tv_nsec == st->st_mtim.tv_nsec) {
+            file->checked = time(NULL);
+            file = useFile(cache, file);
+        } else {
+            removeFile(cache, file);
+            file = NULL;
+        }
+    }
+    if(file == NULL)
+        cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return file;
+}
+
+struct CachedFile *addCachedFile(struct FileCache *cache, const char *path,
+        const struct stat *st, int fd, const char *headers)
+{
+    if(cache->nbuckets == 0 || st->st_size > fileCacheMaxFile(cache))
+        return NULL;
+
+    struct CachedFile *file = (struct CachedFile *)calloc(1, sizeof(struct CachedFile));
+    if(file == NULL)
+        return NULL;
+    file->path = strdup(path);
+    file->headers = strdup(headers);
+    file->data = (char *)malloc(st->st_size > 0 ? st->st_size : 1);
+    if(file->path == NULL || file->headers == NULL || file->data == NULL) {
+        freeFile(file);
+        return NULL; // it's only a cache
+    }
+    file->dev = st->st_dev;
+    file->ino = st->st_ino;
+    file->size = st->st_size;
+    file->mtime = st->st_mtim;
+    file->checked = time(NULL);
+
+    off_t off = 0;
+    while(off < file->size) {
+        ssize_t n = pread(fd, file->data + off, file->size - off, off);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0) {
+            // it shrank under us; don't cache what we can't be sure of
+            freeFile(file);
+            return NULL;
+        }
+        off += n;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    struct CachedFile **slot = findSlot(cache, path);
+    if(*slot)
+        removeFile(cache, *slot); // someone else got there first
+
+    while(cache->bytes + file->size > cache->budget && cache->lruTail)
+        removeFile(cache, cache->lruTail);
+
+    slot = findSlot(cache, path);
+    file->hashNext = *slot;
+    *slot = file;
+    lruPushFront(cache, file);
+    cache->bytes += file->size;
+    file->refs = 2; // the cache's and the caller's
+
+    pthread_mutex_unlock(&cache->lock);
+    return file;
+}
+
+void releaseCachedFile(struct FileCache *cache, struct CachedFile *file)
+{
+    pthread_mutex_lock(&cache->lock);
+    int refs = --file->refs;
+    pthread_mutex_unlock(&cache->lock);
+    if(refs == 0)
+        freeFile(file);
+}
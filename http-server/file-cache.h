@@ -0,0 +1,96 @@
+/*
+ * file-cache.h
+*/
+
+#ifndef _FILE_CACHE_H_
+#define _FILE_CACHE_H_
+
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/*
+ * a file held in memory, with the header lines that describe it
+*/
+struct CachedFile {
+    char *path;
+    dev_t dev;              // the file it was read from
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    time_t checked;         // when it was last compared with the file
+
+    char *headers;          // each ending in "\r\n"
+    char *data;             // size bytes
+
+    int refs;               // requests sending it, plus one while cached
+    struct CachedFile *hashNext;
+    struct CachedFile *lruPrev;
+    struct CachedFile *lruNext;
+};
+
+/*
+ * a cache of static files, keyed by path
+ *
+ * it holds at most budget bytes of file data and evicts the least
+ * recently used files first.  a file is served from memory for up to
+ * a second after it was last compared with the one on disk; after
+ * that, the next request stat()s the file and the copy is dropped if
+ * its inode, size or modification time changed.
+*/
+struct FileCache {
+    pthread_mutex_t lock;
+
+    // all protected by lock
+    struct CachedFile **buckets;
+    size_t nbuckets;        // a power of two; 0 if disabled
+    struct CachedFile *lruHead;
+    struct CachedFile *lruTail;
+    size_t bytes;
+    size_t budget;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+/*
+ * set up a cache of up to budget bytes; a budget of 0 disables it
+ * returns 0 on success, -1 if memory could not be allocated
+*/
+int initFileCache(struct FileCache *cache, size_t budget);
+
+/*
+ * files larger than this are not cached
+*/
+size_t fileCacheMaxFile(struct FileCache *cache);
+
+/*
+ * the cached copy of path, if it was compared with the file on disk
+ * within the last second
+ * returns NULL otherwise; the caller must then stat() the file and
+ * call validateCachedFile()
+*/
+struct CachedFile *findCachedFile(struct FileCache *cache, const char *path);
+
+/*
+ * the cached copy of path, if it is still the file st describes
+ * a copy that isn't is dropped, and NULL returned; st is NULL if the
+ * file is gone
+*/
+struct CachedFile *validateCachedFile(struct FileCache *cache,
+        const char *path, const struct stat *st);
+
+/*
+ * read the file st describes from fd and cache it under path
+ * returns the new copy, or NULL if the file is too big or could not
+ * be read
+*/
+struct CachedFile *addCachedFile(struct FileCache *cache, const char *path,
+        const struct stat *st, int fd, const char *headers);
+
+/*
+ * done with a copy returned by one of the functions above
+*/
+void releaseCachedFile(struct FileCache *cache, struct CachedFile *file);
+
+#endif /* _FILE_CACHE_H_ */
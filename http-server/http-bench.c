@@ -0,0 +1,448 @@
+/*
+ * http-bench.c
+ *
+ * load generator for http-server: replays the requests of a URL file
+ * over several keep-alive connections for a while, and reports, for
+ * every kind of request, how many were answered per second, their
+ * latency percentiles and the bytes per second they brought back
+ *
+ * every line of the URL file is a label and a path:
+ *
+ *     static-small /bench/small-17.html
+ *     mdb-lookup /mdb-lookup?key=abc
+ *
+ * the requests are sent in the order of the file (each connection
+ * starting at a different place), so the mix of the file is the mix
+ * of the traffic.  the results are also appended as one JSON object
+ * per label to the file given with -o, so runs can be compared.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MAX_LABELS 32
+#define MAX_LINE 4096
+
+// keep trying to connect for this long, so that the benchmark can be
+// started along with the server
+#define CONNECT_TRIES 100
+#define CONNECT_RETRY_NANOS 100000000L
+
+static void die(const char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-c connections] [-d seconds] [-o json-file] "
+            "-u url-file <server-host> <server-port>\n", prog);
+    fprintf(stderr, "  -c  number of connections, each in its own thread "
+            "(default 8)\n");
+    fprintf(stderr, "  -d  how long to run, in seconds (default 5)\n");
+    fprintf(stderr, "  -o  append the results to this file, one JSON object "
+            "per label\n");
+    fprintf(stderr, "  -u  the requests to send, one \"label path\" per line\n");
+    exit(1);
+}
+
+static int64_t nowNanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct Url {
+    int label;
+    char *path;
+};
+
+static char *labels[MAX_LABELS];
+static int nLabels;
+static struct Url *urls;
+static int nUrls;
+
+static const char *host;
+static const char *port;
+static int64_t startTime;
+static int64_t endTime;
+
+/*
+ * what one connection measured for one label
+*/
+struct LabelStats {
+    int64_t *latencies;     // nanoseconds, one per answered request
+    long count;
+    long cap;
+    long errors;            // answered with other than 200, or not at all
+    long bytes;             // headers and bodies received
+};
+
+struct BenchConn {
+    int firstUrl;
+    struct LabelStats stats[MAX_LABELS];
+};
+
+static void readUrls(const char *file)
+{
+    FILE *fp = fopen(file, "r");
+    if(fp == NULL)
+        die(file);
+
+    char line[MAX_LINE];
+    int cap = 0;
+    while(fgets(line, sizeof(line), fp)) {
+        char *label = strtok(line, " \t\r\n");
+        char *path = strtok(NULL, " \t\r\n");
+        if(label == NULL)
+            continue;
+        if(path == NULL || path[0] != '/') {
+            fprintf(stderr, "%s: bad line for %s\n", file, label);
+            exit(1);
+        }
+
+        int i;
+        for(i = 0; i < nLabels; i++) {
+            if(strcmp(labels[i], label) == 0)
+                break;
+        }
+        if(i == nLabels) {
+            if(nLabels == MAX_LABELS) {
+                fprintf(stderr, "%s: more than %d labels\n", file, MAX_LABELS);
+                exit(1);
+            }
+            if((labels[nLabels++] = strdup(label)) == NULL)
+                die("strdup() failed");
+        }
+
+        if(nUrls == cap) {
+            cap = cap ? cap * 2 : 1024;
+            if((urls = realloc(urls, cap * sizeof(struct Url))) == NULL)
+                die("realloc() failed");
+        }
+        urls[nUrls].label = i;
+        if((urls[nUrls].path = strdup(path)) == NULL)
+            die("strdup() failed");
+        nUrls++;
+    }
+    fclose(fp);
+
+    if(nUrls == 0) {
+        fprintf(stderr, "%s: no requests\n", file);
+        exit(1);
+    }
+}
+
+static int connectServer(void)
+{
+    struct addrinfo hints, *res, *ai;
+    int err, tries;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if((err = getaddrinfo(host, port, &hints, &res)) != 0) {
+        fprintf(stderr, "getaddrinfo() failed: %s\n", gai_strerror(err));
+        exit(1);
+    }
+
+    for(tries = 0; tries < CONNECT_TRIES; tries++) {
+        for(ai = res; ai != NULL; ai = ai->ai_next) {
+            int sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if(sock < 0)
+                die("socket() failed");
+            if(connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) {
+                int on = 1;
+                setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                freeaddrinfo(res);
+                return sock;
+            }
+            err = errno;
+            close(sock);
+            errno = err;
+        }
+        if(errno != ECONNREFUSED)
+            break;
+        struct timespec ts = { 0, CONNECT_RETRY_NANOS };
+        nanosleep(&ts, NULL);
+    }
+    die("connect() failed");
+    return -1;
+}
+
+/*
+ * send a GET for path and read the whole response
+ * returns the status code, or -1 if the connection failed; *bytes is
+ * set to the size of the response and *keepAlive to whether the server
+ * keeps the connection open
+*/
+static int get(int sock, FILE *fp, const char *path, long *bytes, int *keepAlive)
+{
+    char buf[MAX_LINE];
+    int n = snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n",
+            path, host);
+    if(n >= (int)sizeof(buf) || send(sock, buf, n, MSG_NOSIGNAL) != n)
+        return -1;
+
+    int statusCode;
+    if(fgets(buf, sizeof(buf), fp) == NULL ||
+            sscanf(buf, "HTTP/%*d.%*d %d", &statusCode) != 1)
+        return -1;
+    *bytes = strlen(buf);
+
+    long contentLength = -1;
+    *keepAlive = 1;
+    while(1) {
+        if(fgets(buf, sizeof(buf), fp) == NULL)
+            return -1;
+        *bytes += strlen(buf);
+        if(strcmp(buf, "\r\n") == 0 || strcmp(buf, "\n") == 0)
+            break;
+        if(strncasecmp(buf, "Content-Length:", 15) == 0)
+            contentLength = atol(buf + 15);
+        else if(strncasecmp(buf, "Connection:", 11) == 0 && strstr(buf, "close"))
+            *keepAlive = 0;
+    }
+
+    // every response of http-server carries a Content-Length
+    if(contentLength < 0)
+        return -1;
+    while(contentLength > 0) {
+        size_t want = contentLength < (long)sizeof(buf) ?
+            (size_t)contentLength : sizeof(buf);
+        size_t got = fread(buf, 1, want, fp);
+        if(got == 0)
+            return -1;
+        contentLength -= got;
+        *bytes += got;
+    }
+    return statusCode;
+}
+
+static void addLatency(struct LabelStats *stats, int64_t nanos)
+{
+    if(stats->count == stats->cap) {
+        stats->cap = stats->cap ? stats->cap * 2 : 1024;
+        stats->latencies = realloc(stats->latencies, stats->cap * sizeof(int64_t));
+        if(stats->latencies == NULL)
+            die("realloc() failed");
+    }
+    stats->latencies[stats->count++] = nanos;
+}
+
+static void *runConn(void *arg)
+{
+    struct BenchConn *conn = arg;
+    int sock = -1;
+    FILE *fp = NULL;
+    int u = conn->firstUrl;
+
+    while(1) {
+        if(fp == NULL) {
+            sock = connectServer();
+            if((fp = fdopen(sock, "r")) == NULL)
+                die("fdopen() failed");
+        }
+
+        int64_t sent = nowNanos();
+        if(sent >= endTime)
+            break;
+
+        struct LabelStats *stats = &conn->stats[urls[u].label];
+        long bytes = 0;
+        int keepAlive = 0;
+        int statusCode = get(sock, fp, urls[u].path, &bytes, &keepAlive);
+        if(statusCode < 0) {
+            // try again on a new connection
+            if(sent >= startTime)
+                stats->errors++;
+            fclose(fp);
+            fp = NULL;
+            continue;
+        }
+        if(sent >= startTime) {
+            addLatency(stats, nowNanos() - sent);
+            stats->bytes += bytes;
+            if(statusCode != 200)
+                stats->errors++;
+        }
+        if(!keepAlive) {
+            fclose(fp);
+            fp = NULL;
+        }
+        if(++u == nUrls)
+            u = 0;
+    }
+
+    if(fp)
+        fclose(fp);
+    return NULL;
+}
+
+static int compareNanos(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentileMicros(const int64_t *sorted, long n, double fraction)
+{
+    long i = (long)(fraction * n + 0.5);
+    if(i > 0)
+        i--;
+    if(i >= n)
+        i = n - 1;
+    return sorted[i] / 1000.0;
+}
+
+/*
+ * print the results for one label, merged across the connections, to
+ * stdout and, if json is not NULL, to json
+*/
+static void report(const char *label, struct LabelStats *all, int seconds,
+        int conns, time_t when, FILE *json)
+{
+    long n = all->count;
+    double sum = 0;
+    long i;
+    qsort(all->latencies, n, sizeof(int64_t), compareNanos);
+    for(i = 0; i < n; i++)
+        sum += all->latencies[i];
+
+    double p50 = 0, p99 = 0, p999 = 0, max = 0, mean = 0;
+    if(n > 0) {
+        p50 = percentileMicros(all->latencies, n, 0.50);
+        p99 = percentileMicros(all->latencies, n, 0.99);
+        p999 = percentileMicros(all->latencies, n, 0.999);
+        max = all->latencies[n - 1] / 1000.0;
+        mean = sum / n / 1000.0;
+    }
+
+    printf("%-14s %9ld %9.0f %7ld %12.0f %9.1f %9.1f %9.1f %9.1f\n",
+            label, n, (double)n / seconds, all->errors,
+            (double)all->bytes / seconds, p50, p99, p999, max);
+
+    if(json) {
+        fprintf(json, "{\"time\": %ld, \"label\": \"%s\", \"connections\": %d, "
+                "\"seconds\": %d, \"requests\": %ld, \"errors\": %ld, "
+                "\"requests_per_sec\": %.1f, \"bytes_per_sec\": %.0f, "
+                "\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, "
+                "\"max_us\": %.1f, \"mean_us\": %.1f}\n",
+                (long)when, label, conns, seconds, n, all->errors,
+                (double)n / seconds, (double)all->bytes / seconds,
+                p50, p99, p999, max, mean);
+    }
+}
+
+/*
+ * add the latencies and counters of from to into
+*/
+static void mergeStats(struct LabelStats *into, const struct LabelStats *from)
+{
+    long i;
+    for(i = 0; i < from->count; i++)
+        addLatency(into, from->latencies[i]);
+    into->errors += from->errors;
+    into->bytes += from->bytes;
+}
+
+int main(int argc, char **argv)
+{
+    int conns = 8;
+    int seconds = 5;
+    const char *jsonFile = NULL;
+    const char *urlFile = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "c:d:o:u:")) != -1) {
+        switch(opt) {
+            case 'c':
+                conns = atoi(optarg);
+                if(conns < 1 || conns > 10000)
+                    usage(argv[0]);
+                break;
+            case 'd':
+                seconds = atoi(optarg);
+                if(seconds < 1)
+                    usage(argv[0]);
+                break;
+            case 'o':
+                jsonFile = optarg;
+                break;
+            case 'u':
+                urlFile = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if(argc - optind != 2 || urlFile == NULL)
+        usage(argv[0]);
+    host = argv[optind];
+    port = argv[optind + 1];
+    readUrls(urlFile);
+
+    struct BenchConn *bench = calloc(conns, sizeof(struct BenchConn));
+    pthread_t *threads = malloc(conns * sizeof(pthread_t));
+    if(bench == NULL || threads == NULL)
+        die("malloc() failed");
+
+    // the first half second warms up the connections and the caches,
+    // and is not counted
+    startTime = nowNanos() + 500000000;
+    endTime = startTime + seconds * 1000000000LL;
+    time_t when = time(NULL);
+
+    int i, j;
+    for(i = 0; i < conns; i++) {
+        bench[i].firstUrl = (long long)nUrls * i / conns;
+        if(pthread_create(&threads[i], NULL, runConn, &bench[i]) != 0)
+            die("pthread_create() failed");
+    }
+    for(i = 0; i < conns; i++)
+        pthread_join(threads[i], NULL);
+
+    FILE *json = NULL;
+    if(jsonFile && (json = fopen(jsonFile, "a")) == NULL)
+        die(jsonFile);
+
+    printf("%d connections, %d s\n", conns, seconds);
+    printf("%-14s %9s %9s %7s %12s %9s %9s %9s %9s\n", "label", "requests",
+            "req/s", "errors", "bytes/s", "p50 us", "p99 us", "p999 us", "max us");
+
+    struct LabelStats total;
+    memset(&total, 0, sizeof(total));
+    for(j = 0; j < nLabels; j++) {
+        struct LabelStats all;
+        memset(&all, 0, sizeof(all));
+        for(i = 0; i < conns; i++) {
+            mergeStats(&all, &bench[i].stats[j]);
+            mergeStats(&total, &bench[i].stats[j]);
+            free(bench[i].stats[j].latencies);
+        }
+        report(labels[j], &all, seconds, conns, when, json);
+        free(all.latencies);
+    }
+    report("total", &total, seconds, conns, when, json);
+    free(total.latencies);
+
+    if(json && fclose(json) != 0)
+        die(jsonFile);
+
+    free(bench);
+    free(threads);
+    return total.errors ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * http-metrics.c
+*/
+
+#include "http-metrics.h"
+
+// upper bounds of the buckets, in seconds
+static const double bucketBounds[HISTOGRAM_BUCKETS] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+    0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+};
+
+void startTimer(struct timespec *start)
+{
+    clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+void observeDuration(struct Histogram *hist, const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long nanos = (now.tv_sec - start->tv_sec) * 1000000000LL 
+        + (now.tv_nsec - start->tv_nsec);
+    if(nanos < 0)
+        nanos = 0;
+
+    double seconds = nanos / 1e9;
+    int i = 0;
+    while(i < HISTOGRAM_BUCKETS && seconds > bucketBounds[i])
+        i++;
+
+    countMetric(&hist->buckets[i], 1);
+    countMetric(&hist->sumNanos, nanos);
+}
+
+void printHistogram(FILE *out, const char *name, const char *labels,
+        struct Histogram *hist)
+{
+    const char *sep = labels ? "," : "";
+    if(labels == NULL)
+        labels = "";
+
+    // Prometheus buckets count everything up to their bound
+    unsigned long cumulative = 0;
+    int i;
+    for(i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        cumulative += readMetric(&hist->buckets[i]);
+        fprintf(out, "%s_bucket{%s%sle=\"%g\"} %lu\n", 
+                name, labels, sep, bucketBounds[i], cumulative);
+    }
+    cumulative += readMetric(&hist->buckets[HISTOGRAM_BUCKETS]);
+    fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, cumulative);
+
+    // the buckets are read one by one while requests go on, so the
+    // count is taken to be their total rather than kept separately
+    fprintf(out, "%s_sum%s%s%s %.9f\n", name, *labels ? "{" : "", labels, 
+            *labels ? "}" : "", readMetric(&hist->sumNanos) / 1e9);
+    fprintf(out, "%s_count%s%s%s %lu\n", name, *labels ? "{" : "", labels,
+            *labels ? "}" : "", cumulative);
+}
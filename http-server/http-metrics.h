@@ -0,0 +1,56 @@
+/*
+ * http-metrics.h
+*/
+
+#ifndef _HTTP_METRICS_H_
+#define _HTTP_METRICS_H_
+
+#include <stdio.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#define HISTOGRAM_BUCKETS 16
+
+/*
+ * a histogram of durations, reported in the Prometheus text format
+ *
+ * observing a duration takes two atomic adds and no lock, so the
+ * workers never wait on each other to record one.
+*/
+struct Histogram {
+    atomic_ulong buckets[HISTOGRAM_BUCKETS + 1];    // the last one is +Inf
+    atomic_ulong sumNanos;
+};
+
+/*
+ * add a counter, without ordering it against anything else
+*/
+static inline void countMetric(atomic_ulong *counter, unsigned long n)
+{
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static inline unsigned long readMetric(atomic_ulong *counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/*
+ * the time to measure a duration from
+*/
+void startTimer(struct timespec *start);
+
+/*
+ * record the time since start in hist
+*/
+void observeDuration(struct Histogram *hist, const struct timespec *start);
+
+/*
+ * write hist to out as the Prometheus histogram name, with labels
+ * (e.g. "path=\"static\"") added to every sample, or NULL
+ * the caller writes the # HELP and # TYPE lines
+*/
+void printHistogram(FILE *out, const char *name, const char *labels,
+        struct Histogram *hist);
+
+#endif /* _HTTP_METRICS_H_ */
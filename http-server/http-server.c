@@ -5,18 +5,44 @@
 // import libraries
 #include <stdio.h>      /* for printf() and fprintf() */
 #include <sys/socket.h> /* for socket(), bind(), and connect() */
-#include <arpa/inet.h>  /* for sockaddr_in and inet_ntoa() */
+#include <arpa/inet.h>  /* for sockaddr_in and inet_ntop() */
 #include <stdlib.h>     /* for atoi() and exit() */
 #include <string.h>     /* for memset() */
+#include <strings.h>    /* for strcasecmp() */
+#include <ctype.h>      /* for isxdigit() */
 #include <unistd.h>     /* for close() */
 #include <time.h>       /* for time() */
 #include <netdb.h>      /* for gethostbyname() */
 #include <signal.h>     /* for signal() */
 #include <sys/stat.h>   /* for stat() */
+#include <fcntl.h>      /* for open() */
+#include <sys/sendfile.h> /* for sendfile() */
+#include <errno.h>      /* for errno */
+#include <pthread.h>    /* for pthread_create() */
+#include <sys/uio.h>    /* for writev() */
 
-#define MAXPENDING 5
+#include "mdb-proto.h"  /* for the binary lookup protocol */
+#include "mdb-backend.h"
+#include "file-cache.h"
+#include "page-cache.h"
+#include "single-flight.h"
+#include "http-metrics.h"
+#include "client-conns.h"
+
+#define MAXPENDING 128
 #define MAX_BUF_SIZE 4096
 #define MAX_HOSTNAME_LEN 256
+#define DEFAULT_WORKERS 16
+#define DEFAULT_MDB_CONNS 4
+#define DEFAULT_MDB_TIMEOUT 5
+#define DEFAULT_IDLE_TIMEOUT 5
+#define DEFAULT_MAX_REQUESTS 100
+#define MAX_WORKERS 1024
+#define MAX_BACKENDS 64
+#define MAX_REQUEST_BODY (1024 * 1024)
+#define DEFAULT_FILE_CACHE_MB 16
+#define DEFAULT_PAGE_CACHE_MB 8
+#define DEFAULT_PAGE_TTL 10
 
 static void die(const char *msg) 
 {
@@ -29,33 +55,139 @@ static struct {
     unsigned short port;
 } localServerInfo;
 
-static int createMdbSocketConnection(const char *mdbHost, unsigned short mdbPort)
+// talk to mdb-lookup-server in its binary protocol
+static int mdbBinary;
+
+// the connections to each mdb-lookup-server, shared by all workers;
+// each server holds a shard of the database
+static struct MdbBackend mdbBackends[MAX_BACKENDS];
+static int nBackends;
+
+static const char *webRoot;
+static int servSock;
+static struct FileCache fileCache;
+static struct PageCache pageCache;
+
+// identical lookups under way at the same time are done only once
+static struct FlightGroup lookupFlights;
+static struct ClientConns clientConns;
+
+// what /metrics reports; all of it is updated with atomic adds only
+static struct {
+    atomic_ulong requests[600];     // by status code
+    struct Histogram staticTime;    // of requests for files
+    struct Histogram mdbTime;       // of /mdb-lookup requests
+    struct Histogram backendTime;   // of lookups on mdb-lookup-server
+    atomic_ulong bytesSent;
+} metrics;
+
+// how long a connection may sit idle between requests (seconds),
+// and how many requests it may carry
+static int idleTimeout = DEFAULT_IDLE_TIMEOUT;
+static int maxRequests = DEFAULT_MAX_REQUESTS;
+
+/*
+ * a request being answered on a client connection
+*/
+struct HttpRequest {
+    int sock;               // the client socket
+    FILE *fp;               // for reading requests from sock
+
+    char *method;           // from the request line
+    char *requestURI;
+    char *httpVersion;
+    int http11;             // the client speaks HTTP/1.1
+
+    // from the headers
+    int connectionClose;        // Connection: close
+    int connectionKeepAlive;    // Connection: keep-alive
+    long long contentLength;    // of the request body
+    int transferEncoding;       // a request body of unknown length
+    char ifNoneMatch[256];      // empty if not sent
+    char ifModifiedSince[64];
+
+    int keepAlive;          // leave the connection open after the response
+};
+
+/*
+ * send a lookup request for key to mdb-lookup-server, in one send() so
+ * that it goes out in one segment
+ * returns 0 on success, -1 on failure
+*/
+static int sendMdbRequest(int mdbSock, const char *key)
 {
-    int sock;
-    struct sockaddr_in servAddr;
-    struct hostent *he;
+    char buf[1 + 1000];
+    size_t keyLen = strlen(key);
+    size_t len;
 
-    // get server ip from server name
-    if((he = gethostbyname(mdbHost)) == NULL)
-        die("gethostbyname() failed");
+    if(mdbBinary) {
+        // the server only looks at the first few characters anyway
+        if(keyLen > 255)
+            keyLen = 255;
+        buf[0] = (unsigned char)keyLen;
+        memcpy(buf + 1, key, keyLen);
+        len = 1 + keyLen;
+    } else {
+        if(keyLen > sizeof(buf) - 1)
+            keyLen = sizeof(buf) - 1;
+        memcpy(buf, key, keyLen);
+        buf[keyLen] = '\n';
+        len = keyLen + 1;
+    }
 
-    char *serverIP = inet_ntoa(*(struct in_addr *)he->h_addr);
+    if(send(mdbSock, buf, len, 0) != (ssize_t)len)
+        return -1;
+    return 0;
+}
 
-    // creating socket
-    if((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) 
-        die("socket() failed");
+/*
+ * read the start of a lookup result from mdb-lookup-server
+ * returns the number of records for the binary protocol,
+ * 0 for the text protocol (where records end with a blank line),
+ * or -1 on failure
+*/
+static long readMdbHeader(FILE *mdbFp)
+{
+    if(!mdbBinary)
+        return 0;
 
-    // construct server address
-    memset(&servAddr, 0, sizeof(servAddr));         /* Zero out structure */
-    servAddr.sin_family = AF_INET;                  /* Internet address family */
-    servAddr.sin_addr.s_addr = inet_addr(serverIP); /* Any incoming interface */
-    servAddr.sin_port = htons(mdbPort);             /* Local port */
+    unsigned char header[1 + 255 + 4];
+    if(fread(header, 1, 1, mdbFp) != 1 || 
+            fread(header + 1, 1, header[0] + 4, mdbFp) != header[0] + 4)
+        return -1;
+    return getBinaryU32(header + 1 + header[0]);
+}
 
-    // connect
-    if(connect(sock, (struct sockaddr *)&servAddr, sizeof(servAddr)) < 0)
-        die("connect() failed");
-    
-    return sock;
+/*
+ * read the next record of a lookup result into line, 
+ * formatted as the text protocol sends it
+ * remaining counts down the records left in a binary result
+ * returns 1 if a record was read, 0 at the end of the result,
+ * or -1 on failure
+*/
+static int readMdbLine(FILE *mdbFp, char *line, int size, long *remaining)
+{
+    if(mdbBinary) {
+        unsigned char rec[BinaryRecSize];
+        if(*remaining == 0)
+            return 0;
+        if(fread(rec, 1, sizeof(rec), mdbFp) != sizeof(rec))
+            return -1;
+        (*remaining)--;
+        snprintf(line, size, "%4u: {%.*s} said {%.*s}\n",
+                (unsigned)getBinaryU32(rec),
+                (int)strnlen((char *)rec + 4, 16), rec + 4,
+                (int)strnlen((char *)rec + 20, 24), rec + 20);
+        return 1;
+    }
+
+    if(fgets(line, size, mdbFp) == NULL)
+        return -1;
+
+    // blank line - end of result
+    if(strcmp("\n", line) == 0)
+        return 0;
+    return 1;
 }
 
 static int createServerSocket(unsigned short port)
@@ -103,6 +235,7 @@ static struct {
     { 501, "Not Implemented" },
     { 502, "Bad Gateway" },
     { 503, "Service Unavailable" },
+    { 504, "Gateway Timeout" },
     { 0, NULL } // marks the end of the list
 };
 
@@ -117,22 +250,107 @@ static inline const char *getReason(int statusCode)
     return "Unknown Status Code";
 }
 
-static void sendStatusLine(int clntSock, int statusCode)
+/*
+ * format the status line and headers of a response
+ * headers holds any further header lines, each ending in "\r\n"
+ * returns a buffer from malloc(); *len is set to its length
+*/
+static char *formatHeaders(struct HttpRequest *req, int statusCode, 
+        long long contentLength, const char *headers, int *len)
 {
-    char buf[1000];
-    const char *reason = getReason(statusCode);
-    sprintf(buf, "HTTP/1.0 %d %s\r\n", statusCode, reason);
-    if(send(clntSock, buf, strlen(buf), 0) != strlen(buf))
-        perror("send() failed");
+    if(headers == NULL)
+        headers = "";
+
+    char *buf = malloc(strlen(headers) + 1000);
+    if(buf == NULL)
+        die("malloc() failed");
+    int n = sprintf(buf, "HTTP/1.1 %d %s\r\n%sConnection: %s\r\n",
+            statusCode, getReason(statusCode), headers,
+            req->keepAlive ? "keep-alive" : "close");
+    // a 304 has no body, nor a length for one
+    if(statusCode != 304)
+        n += sprintf(buf + n, "Content-Length: %lld\r\n", contentLength);
+    n += sprintf(buf + n, "\r\n");
+
+    *len = n;
+    return buf;
 }
 
-static void sendErrorStatus(int clntSock, int statusCode)
+/*
+ * write all of iov to sock, however many writev()s it takes
+ * returns 0 on success, -1 on failure
+*/
+static int writeAll(int sock, struct iovec *iov, int iovcnt)
 {
-    sendStatusLine(clntSock, statusCode);
+    while(iovcnt > 0) {
+        ssize_t n = writev(sock, iov, iovcnt);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        countMetric(&metrics.bytesSent, n);
+        while(iovcnt > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
 
-    if(send(clntSock, "\r\n", strlen("\r\n"), 0) != strlen("\r\n"))
-        perror("send() failed");
+/*
+ * send a whole response, the status line and headers followed by the
+ * len bytes of body, in a single writev() where the socket allows it
+ * returns 0 on success, -1 on failure
+*/
+static int sendResponse(struct HttpRequest *req, int statusCode, 
+        const char *headers, const char *body, size_t len)
+{
+    struct iovec iov[2];
+    int n;
+
+    char *buf = formatHeaders(req, statusCode, len, headers, &n);
+    iov[0].iov_base = buf;
+    iov[0].iov_len = n;
+    iov[1].iov_base = (void *)body;
+    iov[1].iov_len = len;
 
+    int ret = writeAll(req->sock, iov, len > 0 ? 2 : 1);
+    if(ret < 0)
+        req->keepAlive = 0;
+    free(buf);
+    return ret;
+}
+
+/*
+ * send the status line and headers of a response whose body of
+ * contentLength bytes the caller sends next
+ * returns 0 on success, -1 on failure
+*/
+static int sendHeaders(struct HttpRequest *req, int statusCode, 
+        long long contentLength, const char *headers)
+{
+    int n;
+    char *buf = formatHeaders(req, statusCode, contentLength, headers, &n);
+
+    // let the headers share a packet with the start of the body
+    int ret = 0;
+    if(send(req->sock, buf, n, MSG_MORE) != n) {
+        req->keepAlive = 0;
+        ret = -1;
+    } else {
+        countMetric(&metrics.bytesSent, n);
+    }
+    free(buf);
+    return ret;
+}
+
+static void sendErrorStatus(struct HttpRequest *req, int statusCode)
+{
     char buf[1000];
     const char *reason = getReason(statusCode);
     sprintf(buf, 
@@ -141,7 +359,7 @@ static void sendErrorStatus(int clntSock, int statusCode)
             "</body></html>\n",
             statusCode, reason);
 
-    if(send(clntSock, buf, strlen(buf), 0) != strlen(buf))
+    if(sendResponse(req, statusCode, NULL, buf, strlen(buf)) < 0)
         perror("send() failed");
 }
 
@@ -149,135 +367,473 @@ static void sendErrorStatus(int clntSock, int statusCode)
  * redirecting browser to requestURI 
  * with '/' appended
 */
-static void send301Status(int clntSock, const char *requestURI) 
+static void send301Status(struct HttpRequest *req) 
 {
-    sendStatusLine(clntSock, 301);
-
+    const char *requestURI = req->requestURI;
+    char *location = malloc(strlen(localServerInfo.hostName) + strlen(requestURI) + 100);
     char *buf = malloc(2*(strlen(localServerInfo.hostName) + strlen(requestURI)) + 1000);
-    if(buf == NULL)
+    if(location == NULL || buf == NULL)
         die("malloc() failed");
     
-    // send header and format redirection link
+    // format header and redirection link
+    sprintf(location, "Location: http://%s:%d%s/\r\n",
+            localServerInfo.hostName, localServerInfo.port, requestURI);
     sprintf(buf,
-            "Location: http://%s:%d%s/\r\n"
-            "\r\n"
             "<html><body>\n"
             "<h1>301 Moved Permanently</h1>\n"
             "<p>The document has moved "
             "<a href=\"http://%s:%d%s/\">here</a>.</p>\n"
             "</body></html>\n",
-            localServerInfo.hostName, localServerInfo.port, requestURI,
             localServerInfo.hostName, localServerInfo.port, requestURI);
     
-    if(send(clntSock, buf, strlen(buf), 0) != strlen(buf))
+    if(sendResponse(req, 301, location, buf, strlen(buf)) < 0)
         perror("send() failed");
+    free(location);
     free(buf);
 }
 
 /*
- * handle /mdb-lookup and /mdb-lookup?key= requests
- * returns HTTP status code
+ * a lookup under way on one mdb-lookup-server
 */
-static int handleMdbRequest(const char *requestURI, FILE *mdbFp, int mdbSock, int clntSock)
-{
-    int statusCode = 200;
+struct MdbLookup {
+    struct MdbBackend *backend;
+    struct MdbConn *conn;   // NULL once returned to the pool
+    int retried;            // on a new connection
 
-    const char *form =
-        "<html><center><body>\n"
-        "<h1>mdb-lookup</h1>\n"
-        "<p>\n"
-        "<form method=GET action=/mdb-lookup>\n"
-        "lookup: <input type=text name=key>\n"
-        "<input type=submit>\n"
-        "</form>\n"
-        "<p>\n"
-        ;
+    char line[1000];        // the current record, while ret is 1
+    int recNo;              // its record number
+    long remaining;         // as for readMdbLine()
+    int ret;
+};
 
-    const char *keyURI = "/mdb-lookup?key=";
+/*
+ * report a failed lookup, and give its connection back to be closed
+ * returns the HTTP status for the failure
+*/
+static int failMdbLookup(struct MdbLookup *lookup)
+{
+    int timedOut = errno == EAGAIN || errno == EWOULDBLOCK;
+    if(errno)
+        perror("\nmdb-lookup-server connection failed");
+    else
+        fprintf(stderr, "\nmdb-lookup-server connection terminated");
+    returnConn(lookup->backend, lookup->conn, 1);
+    lookup->conn = NULL;
+    return timedOut ? 504 : 502;
+}
 
-    // execute lookup if /mdb-lookup?key= request
-    if(strncmp(requestURI, keyURI, strlen(keyURI)) == 0) 
-    {
-        const char *key = requestURI + strlen(keyURI);
-        fprintf(stderr, "looking up [%s]: ", key);
-        if(send(mdbSock, key, strlen(key), 0) != strlen(key) || 
-                send(mdbSock, "\n", 1, 0) != strlen("\n")) {
-            statusCode = 500; 
-            sendErrorStatus(clntSock, statusCode);
+/*
+ * send the lookup for key on a connection from the backend's pool
+ * returns 200, or the HTTP status for the failure
+*/
+static int sendMdbLookup(struct MdbLookup *lookup, const char *key)
+{
+    for(;;) {
+        lookup->conn = checkoutConn(lookup->backend);
+        if(lookup->conn == NULL) {
             perror("\nmdb-lookup-server connection failed");
-            return statusCode;
+            return errno == ETIMEDOUT ? 503 : 502;
         }
 
-        // send status line
-        sendStatusLine(clntSock, statusCode);
-        if(send(clntSock, "\r\n", strlen("\r\n"), 0) != strlen("\r\n"))
-            perror("send() failed");
-        
-        // send HTML form
-        if(send(clntSock, form, strlen(form), 0) != strlen(form))
-            return statusCode;
+        errno = 0;
+        if(sendMdbRequest(lookup->conn->sock, key) == 0)
+            return 200;
 
-        // read lines from mdb-lookup-server 
-        // and send to browser, in HTML table
-        char line[1000];
-        char *table_header = "<p><table border>";
-        if(send(clntSock, table_header, strlen(table_header), 0) != strlen(table_header))
+        int statusCode = failMdbLookup(lookup);
+        if(statusCode == 504 || lookup->retried++)
             return statusCode;
-        
-        int row = 1;
-        for(;;) {
-            // read from mdb-lookup-server
-            if(fgets(line, sizeof(line), mdbFp) == NULL) {
-                if(ferror(mdbFp))
-                    perror("\nmdb-lookup-server connection failed");
-                else
-                    fprintf(stderr, "\nmdb-lookup-server connection terminated");
-                return statusCode;
-            }
+    }
+}
 
-            // blank line - exit loop
-            if(strcmp("\n", line) == 0)
-                break;
-            
-            // format line as table row
-            char *table_row;
-            if(row++ % 2)
-                table_row = "\n<tr><td bgcolor=#acbcc2>";
-            else
-                table_row = "\n<tr><td bgcolor=#8facb8>";
-            
-            if(send(clntSock, table_row, strlen(table_row), 0) != strlen(table_row))
-                return statusCode;
-            if(send(clntSock, line, strlen(line), 0) != strlen(line))
-                return statusCode;
-        }   
-
-        char *table_footer = "\n</table>\n";
-        if(send(clntSock, table_footer, strlen(table_footer), 0) != strlen(table_footer))
+/*
+ * read the next record of a lookup into lookup->line
+ * returns as readMdbLine()
+*/
+static int readMdbRecord(struct MdbLookup *lookup)
+{
+    lookup->ret = readMdbLine(lookup->conn->fp, lookup->line, 
+            sizeof(lookup->line), &lookup->remaining);
+    if(lookup->ret > 0)
+        lookup->recNo = atoi(lookup->line);
+    return lookup->ret;
+}
+
+/*
+ * read the start of the result of a lookup sent by sendMdbLookup(),
+ * up to its first record
+ * the server may have closed a connection while it sat in the pool,
+ * so a lookup that fails is sent once more on a new connection
+ * returns 200, or the HTTP status for the failure
+*/
+static int startMdbResult(struct MdbLookup *lookup, const char *key)
+{
+    for(;;) {
+        errno = 0;
+        if((lookup->remaining = readMdbHeader(lookup->conn->fp)) >= 0 &&
+                readMdbRecord(lookup) >= 0)
+            return 200;
+
+        int statusCode = failMdbLookup(lookup);
+        if(statusCode == 504 || lookup->retried++)
             return statusCode;
-    } 
-    else {
-        // send only form
-        sendStatusLine(clntSock, statusCode);
-        send(clntSock, "\r\n", strlen("\r\n"), 0);
-        if(send(clntSock, form, strlen(form), 0) != strlen(form))
+        if((statusCode = sendMdbLookup(lookup, key)) != 200)
             return statusCode;
     }
+}
+
+/*
+ * decode the %XX escapes and '+'s of a key from a query string
+ * the key ends at a line break, which would end the request to
+ * mdb-lookup-server
+*/
+static void decodeKey(const char *src, char *key, size_t size)
+{
+    size_t n = 0;
+    while(*src && n < size - 1) {
+        char c = *src++;
+        if(c == '+') {
+            c = ' ';
+        } else if(c == '%' && isxdigit((unsigned char)src[0]) && 
+                isxdigit((unsigned char)src[1])) {
+            char hex[3] = { src[0], src[1], '\0' };
+            c = (char)strtol(hex, NULL, 16);
+            src += 2;
+        }
+        if(c == '\0' || c == '\r' || c == '\n')
+            break;
+        key[n++] = c;
+    }
+    key[n] = '\0';
+}
+
+/*
+ * a page being rendered
+*/
+struct PageBuf {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+static void appendPage(struct PageBuf *page, const char *data, size_t len)
+{
+    if(page->len + len > page->size) {
+        size_t size = page->size ? page->size : MAX_BUF_SIZE;
+        while(size < page->len + len)
+            size *= 2;
+        if((page->data = realloc(page->data, size)) == NULL)
+            die("realloc() failed");
+        page->size = size;
+    }
+    memcpy(page->data + page->len, data, len);
+    page->len += len;
+}
+
+static const char *mdbForm =
+    "<html><center><body>\n"
+    "<h1>mdb-lookup</h1>\n"
+    "<p>\n"
+    "<form method=GET action=/mdb-lookup>\n"
+    "lookup: <input type=text name=key>\n"
+    "<input type=submit>\n"
+    "</form>\n"
+    "<p>\n"
+    ;
+
+// closes the HTML page
+static const char *mdbPageEnd = "</body></center></html>\n";
+#define MDB_PAGE_END_LEN strlen("</body></html>\n")
+
+/*
+ * look key up on every mdb-lookup-server and render the page of
+ * results into page
+ * returns HTTP status code; the page is only complete for 200
+*/
+static int renderMdbPage(const char *key, struct PageBuf *page)
+{
+    struct MdbLookup lookups[MAX_BACKENDS];
+    int statusCode = 200;
+    int i;
+
+    for(i = 0; i < nBackends; i++) {
+        lookups[i].backend = &mdbBackends[i];
+        lookups[i].conn = NULL;
+        lookups[i].retried = 0;
+    }
+
+    struct timespec start;
+    startTimer(&start);
+
+    // every shard is sent the lookup before any result is read, so
+    // that they all search at once
+    for(i = 0; i < nBackends && statusCode == 200; i++)
+        statusCode = sendMdbLookup(&lookups[i], key);
+    for(i = 0; i < nBackends && statusCode == 200; i++)
+        statusCode = startMdbResult(&lookups[i], key);
+    if(statusCode != 200)
+        goto lookup_end;
+
+    // HTML form
+    appendPage(page, mdbForm, strlen(mdbForm));
+
+    // read lines from mdb-lookup-server 
+    // and format them as an HTML table
+    char *table_header = "<p><table border>";
+    appendPage(page, table_header, strlen(table_header));
+    
+    int row = 1;
+    for(;;) {
+        // each shard's records come in order; merge them by number
+        // (there are few enough shards to look at each one)
+        struct MdbLookup *next = NULL;
+        for(i = 0; i < nBackends; i++) {
+            if(lookups[i].ret > 0 &&
+                    (next == NULL || lookups[i].recNo < next->recNo))
+                next = &lookups[i];
+        }
+        if(next == NULL)
+            break;
+
+        // format line as table row
+        char *table_row;
+        if(row++ % 2)
+            table_row = "\n<tr><td bgcolor=#acbcc2>";
+        else
+            table_row = "\n<tr><td bgcolor=#8facb8>";
+        
+        appendPage(page, table_row, strlen(table_row));
+        appendPage(page, next->line, strlen(next->line));
+
+        // read from mdb-lookup-server
+        errno = 0;
+        if(readMdbRecord(next) < 0) {
+            // a connection left in the middle of a result is closed
+            statusCode = failMdbLookup(next);
+            goto lookup_end;
+        }
+    }   
+
+    char *table_footer = "\n</table>\n";
+    appendPage(page, table_footer, strlen(table_footer));
 
     // close HTML page
-    send(clntSock, "</body></center></html>\n", strlen("</body></html>\n"), 0);
+    appendPage(page, mdbPageEnd, MDB_PAGE_END_LEN);
 
+lookup_end:
+    // after a failure, the other shards' results are left unread
+    for(i = 0; i < nBackends; i++) {
+        if(lookups[i].conn)
+            returnConn(lookups[i].backend, lookups[i].conn, statusCode != 200);
+    }
+    observeDuration(&metrics.backendTime, &start);
     return statusCode;
 }
 
+/*
+ * send a rendered lookup page, or the error that prevented it
+*/
+static void sendMdbPage(struct HttpRequest *req, int statusCode, 
+        const char *page, size_t len)
+{
+    if(statusCode != 200)
+        sendErrorStatus(req, statusCode);
+    else
+        sendResponse(req, statusCode, NULL, page, len);
+}
+
+/*
+ * handle /mdb-lookup and /mdb-lookup?key= requests
+ * returns HTTP status code
+*/
+static int handleMdbRequest(struct HttpRequest *req)
+{
+    const char *requestURI = req->requestURI;
+    int statusCode = 200;
+    struct PageBuf page = { NULL, 0, 0 };
+
+    const char *keyURI = "/mdb-lookup?key=";
+
+    // send only form if not a /mdb-lookup?key= request
+    if(strncmp(requestURI, keyURI, strlen(keyURI)) != 0) {
+        appendPage(&page, mdbForm, strlen(mdbForm));
+        appendPage(&page, mdbPageEnd, MDB_PAGE_END_LEN);
+        sendResponse(req, statusCode, NULL, page.data, page.len);
+        free(page.data);
+        return statusCode;
+    }
+
+    // execute lookup
+    char key[1000];
+    decodeKey(requestURI + strlen(keyURI), key, sizeof(key));
+    fprintf(stderr, "looking up [%s]: ", key);
+
+    // a page rendered a moment ago is as good as a new one
+    struct CachedPage *cached = findCachedPage(&pageCache, key);
+    if(cached) {
+        sendMdbPage(req, statusCode, cached->data, cached->len);
+        releaseCachedPage(&pageCache, cached);
+        return statusCode;
+    }
+
+    // so is one being rendered for another client right now
+    int leader;
+    struct Flight *flight = joinFlight(&lookupFlights, key, &leader);
+    if(flight == NULL)
+        die("joinFlight() failed");
+    if(!leader) {
+        statusCode = waitFlight(&lookupFlights, flight);
+        sendMdbPage(req, statusCode, flight->data, flight->len);
+        leaveFlight(&lookupFlights, flight);
+        return statusCode;
+    }
+
+    // the whole page is rendered before any of it is sent, so that it
+    // goes out with a Content-Length in a single writev(), and a
+    // backend failure can still be reported
+    statusCode = renderMdbPage(key, &page);
+    if(statusCode == 200)
+        addCachedPage(&pageCache, key, page.data, page.len);
+    finishFlight(&lookupFlights, flight, statusCode, page.data, page.len);
+
+    // the flight owns the page now
+    sendMdbPage(req, statusCode, page.data, page.len);
+    leaveFlight(&lookupFlights, flight);
+    return statusCode;
+}
+
+/*
+ * the Content-Type header for a file, by its extension
+*/
+static const char *getContentType(const char *file)
+{
+    static const struct {
+        const char *ext;
+        const char *header;
+    } types[] = {
+        { ".html", "Content-Type: text/html\r\n" },
+        { ".htm",  "Content-Type: text/html\r\n" },
+        { ".txt",  "Content-Type: text/plain\r\n" },
+        { ".css",  "Content-Type: text/css\r\n" },
+        { ".js",   "Content-Type: application/javascript\r\n" },
+        { ".png",  "Content-Type: image/png\r\n" },
+        { ".jpg",  "Content-Type: image/jpeg\r\n" },
+        { ".jpeg", "Content-Type: image/jpeg\r\n" },
+        { ".gif",  "Content-Type: image/gif\r\n" },
+        { ".ico",  "Content-Type: image/x-icon\r\n" },
+        { ".pdf",  "Content-Type: application/pdf\r\n" },
+    };
+
+    const char *ext = strrchr(file, '.');
+    if(ext != NULL && strchr(ext, '/') == NULL) {
+        int i;
+        for(i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if(strcasecmp(ext, types[i].ext) == 0)
+                return types[i].header;
+        }
+    }
+    return "Content-Type: application/octet-stream\r\n";
+}
+
+/*
+ * the header lines that describe a file: its type, its ETag and when
+ * it was last modified
+ * buf must have room for MAX_BUF_SIZE bytes
+*/
+static void formatFileHeaders(const char *file, const struct stat *st, char *buf)
+{
+    char date[64];
+    struct tm tm;
+    gmtime_r(&st->st_mtime, &tm);
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    snprintf(buf, MAX_BUF_SIZE, 
+            "%s"
+            "ETag: \"%lx-%llx-%lx%09ld\"\r\n"
+            "Last-Modified: %s\r\n",
+            getContentType(file),
+            (unsigned long)st->st_ino, (unsigned long long)st->st_size,
+            (unsigned long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec,
+            date);
+}
+
+/*
+ * the value of the header line called name in headers
+ * (e.g. "ETag: x\r\n"), up to the end of the line
+*/
+static const char *findHeader(const char *headers, const char *name, size_t *len)
+{
+    const char *p = strstr(headers, name);
+    if(p == NULL)
+        return NULL;
+    p += strlen(name);
+    p += strspn(p, ": ");
+    *len = strcspn(p, "\r\n");
+    return p;
+}
+
+/*
+ * whether the copy of the file the client already has is current,
+ * going by its If-None-Match or, failing that, If-Modified-Since header
+ * headers are the ones formatFileHeaders() gives for the file
+*/
+static int notModified(struct HttpRequest *req, const char *headers)
+{
+    const char *value;
+    size_t len;
+
+    if(req->ifNoneMatch[0]) {
+        if(strcmp(req->ifNoneMatch, "*") == 0)
+            return 1;
+        if((value = findHeader(headers, "ETag", &len)) == NULL)
+            return 0;
+        // one of a comma separated list of ETags
+        const char *p = req->ifNoneMatch;
+        while((p = strstr(p, "\"")) != NULL) {
+            if(strncmp(p, value, len) == 0)
+                return 1;
+            p = strchr(p + 1, '"');
+            if(p == NULL)
+                break;
+            p++;
+        }
+        return 0;
+    }
+
+    // browsers send back the Last-Modified they were given; any other
+    // date just gets the file again
+    if(req->ifModifiedSince[0]) {
+        if((value = findHeader(headers, "Last-Modified", &len)) == NULL)
+            return 0;
+        return strlen(req->ifModifiedSince) == len && 
+            strncmp(req->ifModifiedSince, value, len) == 0;
+    }
+    return 0;
+}
+
+/*
+ * send a file that is held in memory, or a 304 if the client has it
+ * returns HTTP status code
+*/
+static int sendCachedFile(struct HttpRequest *req, struct CachedFile *cached)
+{
+    if(notModified(req, cached->headers)) {
+        sendResponse(req, 304, cached->headers, NULL, 0);
+        return 304;
+    }
+    sendResponse(req, 200, cached->headers, cached->data, cached->size);
+    return 200;
+}
+
 /*
  * handle static file requests
  * returns HTTP status code for browser
 */
-static int handleFileRequest(const char *webRoot, const char *requestURI, int clntSock) 
+static int handleFileRequest(const char *webRoot, struct HttpRequest *req) 
 {
+    const char *requestURI = req->requestURI;
     int statusCode;
-    FILE *fp = NULL;
+    int fd = -1;
+    struct CachedFile *cached;
 
     // create file path
     char *file = (char *)malloc(strlen(webRoot) + strlen(requestURI) + 100);
@@ -288,174 +844,639 @@ static int handleFileRequest(const char *webRoot, const char *requestURI, int cl
     if (file[strlen(file)-1] == '/')
         strcat(file, "index.html");
 
+    // a hot file is served without looking at the disk at all
+    if ((cached = findCachedFile(&fileCache, file)) != NULL) {
+        statusCode = sendCachedFile(req, cached);
+        goto func_end;
+    }
+
     // check filepath is valid
     struct stat st;
-    if (stat(file, &st) == 0 && S_ISDIR(st.st_mode)) {
+    if (stat(file, &st) < 0) {
+        validateCachedFile(&fileCache, file, NULL);
+    } else if (S_ISDIR(st.st_mode)) {
         statusCode = 301; // "Moved Permanently"
-        send301Status(clntSock, requestURI);
+        send301Status(req);
+        goto func_end;
+    } else if ((cached = validateCachedFile(&fileCache, file, &st)) != NULL) {
+        statusCode = sendCachedFile(req, cached);
         goto func_end;
     }
-    fp = fopen(file, "rb");
-    if (fp == NULL) {
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
         statusCode = 404; 
-        sendErrorStatus(clntSock, statusCode);
+        sendErrorStatus(req, statusCode);
+        goto func_end;
+    }
+
+    char headers[MAX_BUF_SIZE];
+    formatFileHeaders(file, &st, headers);
+    if ((cached = addCachedFile(&fileCache, file, &st, fd, headers)) != NULL) {
+        statusCode = sendCachedFile(req, cached);
+        goto func_end;
+    }
+
+    // too big to cache
+    if (notModified(req, headers)) {
+        statusCode = 304;
+        sendResponse(req, statusCode, headers, NULL, 0);
         goto func_end;
     }
 
     // send 200 ok for valid filepath
     statusCode = 200; 
-    sendStatusLine(clntSock, statusCode);
-    send(clntSock, "\r\n", strlen("\r\n"), 0); 
+    if(sendHeaders(req, statusCode, st.st_size, headers) < 0)
+        goto func_end;
 
-    // send file content
-    size_t n;
-    char buf[MAX_BUF_SIZE];
-    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
-        if (send(clntSock, buf, n, 0) != n) 
+    // send file content, straight from the page cache to the socket
+    off_t sent = 0;
+    while (sent < st.st_size) {
+        ssize_t n = sendfile(req->sock, fd, &sent, st.st_size - sent);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            perror("sendfile() failed");
+        if (n <= 0)
             break;
+        countMetric(&metrics.bytesSent, n);
     }
-    if (ferror(fp))
-        perror("fread() failed");
+
+    // cut short, or the file shrank under us: either way the
+    // Content-Length was wrong
+    if (sent != st.st_size)
+        req->keepAlive = 0;
 
 func_end:
     free(file);
-    if(fp)
-        fclose(fp);
+    if(cached)
+        releaseCachedFile(&fileCache, cached);
+    if(fd >= 0)
+        close(fd);
     return statusCode;
 }
 
-int main(int argc, char *argv[])
+/*
+ * the hit and miss counters of a cache, and its hit ratio
+*/
+static void printCacheMetrics(FILE *out, const char *name, 
+        unsigned long hits, unsigned long misses)
 {
-    if(argc != 5)
-    {
-        fprintf(stderr, "usage: %s <server_port> <web_root> <mdb-lookup-host> <mdb-lookup-port>\n", argv[0]);
-        exit(1);
+    fprintf(out, "# HELP http_%s_hits_total Requests answered from the %s.\n"
+            "# TYPE http_%s_hits_total counter\n"
+            "http_%s_hits_total %lu\n", name, name, name, name, hits);
+    fprintf(out, "# HELP http_%s_misses_total Requests not found in the %s.\n"
+            "# TYPE http_%s_misses_total counter\n"
+            "http_%s_misses_total %lu\n", name, name, name, name, misses);
+    fprintf(out, "# HELP http_%s_hit_ratio Hits out of all %s lookups so far.\n"
+            "# TYPE http_%s_hit_ratio gauge\n"
+            "http_%s_hit_ratio %g\n", name, name, name, name,
+            hits + misses ? (double)hits / (hits + misses) : 0.0);
+}
+
+/*
+ * handle /metrics: the counters, in the Prometheus text format
+ * returns HTTP status code
+*/
+static int handleMetricsRequest(struct HttpRequest *req)
+{
+    char *buf;
+    size_t len;
+    FILE *out = open_memstream(&buf, &len);
+    if(out == NULL)
+        die("open_memstream() failed");
+
+    int i;
+    fprintf(out, "# HELP http_requests_total Requests answered, by status code.\n"
+            "# TYPE http_requests_total counter\n");
+    for(i = 0; HTTP_StatusCodes[i].status > 0; i++) {
+        int status = HTTP_StatusCodes[i].status;
+        fprintf(out, "http_requests_total{code=\"%d\"} %lu\n", 
+                status, readMetric(&metrics.requests[status]));
     }
 
-    unsigned short servPort = atoi(argv[1]);
-    const char *webRoot = argv[2];
-    const char *mdbHost = argv[3];
-    unsigned short mdbPort = atoi(argv[4]);
+    fprintf(out, "# HELP http_request_duration_seconds Time to answer a request.\n"
+            "# TYPE http_request_duration_seconds histogram\n");
+    printHistogram(out, "http_request_duration_seconds", "path=\"static\"", 
+            &metrics.staticTime);
+    printHistogram(out, "http_request_duration_seconds", "path=\"mdb-lookup\"", 
+            &metrics.mdbTime);
 
+    fprintf(out, "# HELP http_mdb_lookup_duration_seconds Time from sending a lookup "
+            "to mdb-lookup-server to having read all of its result.\n"
+            "# TYPE http_mdb_lookup_duration_seconds histogram\n");
+    printHistogram(out, "http_mdb_lookup_duration_seconds", NULL, &metrics.backendTime);
 
-    // creating mdb-lookup socket
-    int mdbSock = createMdbSocketConnection(mdbHost, mdbPort);
-    FILE *mdbFp = fdopen(mdbSock, "r");
-    if(mdbFp == NULL)
-        die("fdopen() failed");
+    fprintf(out, "# HELP http_sent_bytes_total Bytes sent to clients.\n"
+            "# TYPE http_sent_bytes_total counter\n"
+            "http_sent_bytes_total %lu\n", readMetric(&metrics.bytesSent));
+    fprintf(out, "# HELP http_active_connections Client connections open.\n"
+            "# TYPE http_active_connections gauge\n"
+            "http_active_connections %ld\n", 
+            atomic_load_explicit(&clientConns.open, memory_order_relaxed));
 
-    // creating server socket
-    int servSock = createServerSocket(servPort);
+    // the caches keep their own counters under their locks; this
+    // isn't on the path of any other request
+    pthread_mutex_lock(&pageCache.lock);
+    unsigned long hits = pageCache.hits;
+    unsigned long misses = pageCache.misses;
+    pthread_mutex_unlock(&pageCache.lock);
+    printCacheMetrics(out, "page_cache", hits, misses);
 
-    char hostname[MAX_HOSTNAME_LEN];
-    hostname[MAX_HOSTNAME_LEN - 1] = '\0';
-    gethostname(hostname, MAX_HOSTNAME_LEN - 1);
-    struct hostent *he;
-    he = gethostbyname(hostname);
+    pthread_mutex_lock(&fileCache.lock);
+    hits = fileCache.hits;
+    misses = fileCache.misses;
+    pthread_mutex_unlock(&fileCache.lock);
+    printCacheMetrics(out, "file_cache", hits, misses);
 
-    strncpy(localServerInfo.hostName, he->h_name, MAX_HOSTNAME_LEN-1);
-    localServerInfo.hostName[MAX_HOSTNAME_LEN-1] = '\0';
-    localServerInfo.port = servPort;
+    pthread_mutex_lock(&lookupFlights.lock);
+    unsigned long led = lookupFlights.led;
+    unsigned long followed = lookupFlights.followed;
+    pthread_mutex_unlock(&lookupFlights.lock);
+    fprintf(out, "# HELP http_mdb_lookups_total Lookups sent to mdb-lookup-server.\n"
+            "# TYPE http_mdb_lookups_total counter\n"
+            "http_mdb_lookups_total %lu\n", led);
+    fprintf(out, "# HELP http_mdb_lookups_shared_total Lookups answered by "
+            "an identical one that was under way.\n"
+            "# TYPE http_mdb_lookups_shared_total counter\n"
+            "http_mdb_lookups_shared_total %lu\n", followed);
+
+    if(fclose(out) != 0)
+        die("fclose() failed");
+    sendResponse(req, 200, "Content-Type: text/plain; version=0.0.4\r\n", buf, len);
+    free(buf);
+    return 200;
+}
+
+/*
+ * note what a request header says about the request
+ * lines that aren't "name: value" are ignored
+*/
+static void parseHeader(struct HttpRequest *req, char *line)
+{
+    char *value = strchr(line, ':');
+    if(value == NULL)
+        return;
+    *value++ = '\0';
+    value += strspn(value, " \t");
+    value[strcspn(value, "\r\n")] = '\0';
+
+    if(strcasecmp(line, "Connection") == 0) {
+        // a comma separated list of options
+        char *saveptr;
+        char *opt;
+        for(opt = strtok_r(value, ", \t", &saveptr); opt != NULL; 
+                opt = strtok_r(NULL, ", \t", &saveptr)) {
+            if(strcasecmp(opt, "close") == 0)
+                req->connectionClose = 1;
+            else if(strcasecmp(opt, "keep-alive") == 0)
+                req->connectionKeepAlive = 1;
+        }
+    }
+    else if(strcasecmp(line, "Content-Length") == 0)
+        req->contentLength = atoll(value);
+    else if(strcasecmp(line, "Transfer-Encoding") == 0)
+        req->transferEncoding = 1;
+    else if(strcasecmp(line, "If-None-Match") == 0)
+        snprintf(req->ifNoneMatch, sizeof(req->ifNoneMatch), "%s", value);
+    else if(strcasecmp(line, "If-Modified-Since") == 0)
+        snprintf(req->ifModifiedSince, sizeof(req->ifModifiedSince), "%s", value);
+}
 
+/*
+ * read a request body that will not be used
+ * returns 0 on success, -1 on failure
+*/
+static int skipBody(FILE *fp, long long len)
+{
+    char buf[MAX_BUF_SIZE];
+    while(len > 0) {
+        size_t n = len < sizeof(buf) ? len : sizeof(buf);
+        if(fread(buf, 1, n, fp) != n)
+            return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * read one request from the connection, answer it and log it
+ * first is set for the first request on the connection
+ * req->keepAlive is cleared if the connection should be closed
+*/
+static void handleRequest(struct HttpRequest *req, 
+        const struct sockaddr_in *clntAddr, int first)
+{
     char line[1000];
     char requestLine[1000];
+    char clntIP[INET_ADDRSTRLEN];
     int statusCode;
-    struct sockaddr_in clntAddr;
-
-    for(;;) 
-    {
-        unsigned int clntLen = sizeof(clntAddr);
-        int clntSock;
-        if((clntSock = accept(servSock, (struct sockaddr *) &clntAddr, &clntLen)) < 0)
-            die("accept() failed");
-
-        FILE *clntFp = fdopen(clntSock, "r");
-        if(clntFp == NULL)
-            die("fdopen failed");
-        
-        char *method = "";
-        char *requestURI = "";
-        char *httpVersion = "";
+    int keepAlive = req->keepAlive;
+    struct timespec start;
+    struct Histogram *timeHist = NULL;
 
-        if(fgets(requestLine, sizeof(requestLine), clntFp) == NULL) {
-            statusCode = 400;
-            goto loop_end;
-        }
+    // until the request has been read, it's unknown whether the
+    // connection can be reused
+    req->keepAlive = 0;
+    req->method = "";
+    req->requestURI = "";
+    req->httpVersion = "";
+    req->http11 = 0;
+    req->connectionClose = 0;
+    req->connectionKeepAlive = 0;
+    req->contentLength = 0;
+    req->transferEncoding = 0;
+    req->ifNoneMatch[0] = '\0';
+    req->ifModifiedSince[0] = '\0';
+
+    if(fgets(requestLine, sizeof(requestLine), req->fp) == NULL) {
+        // the client is done with the connection, or it was idle too long
+        if(!first)
+            return;
+        statusCode = 400;
+        goto func_end;
+    }
+
+    // the time between requests is the client's, not ours
+    startTimer(&start);
 
-        char *token_separators = "\t \r\n"; // tab, space, new line
-        method = strtok(requestLine, token_separators);
-        requestURI = strtok(NULL, token_separators);
-        httpVersion = strtok(NULL, token_separators);
-        char *restOfRequestLine = strtok(NULL, token_separators);
+    char *token_separators = "\t \r\n"; // tab, space, new line
+    char *saveptr;
+    char *method = strtok_r(requestLine, token_separators, &saveptr);
+    char *requestURI = strtok_r(NULL, token_separators, &saveptr);
+    char *httpVersion = strtok_r(NULL, token_separators, &saveptr);
+    char *restOfRequestLine = strtok_r(NULL, token_separators, &saveptr);
+    req->method = method ? method : "";
+    req->requestURI = requestURI ? requestURI : "";
+    req->httpVersion = httpVersion ? httpVersion : "";
 
-        if(!method || !requestURI || !httpVersion || restOfRequestLine) {
+    if(!method || !requestURI || !httpVersion || restOfRequestLine) {
+        statusCode = 400;
+        sendErrorStatus(req, statusCode);
+        goto func_end;
+    }
+
+    // only support GET requests
+    if(strcmp(method, "GET") != 0) {
+        statusCode = 501;
+        sendErrorStatus(req, statusCode);
+        goto func_end; 
+    }
+
+    // only support HTTP/1.0 and 1.1
+    if(strcmp(httpVersion, "HTTP/1.0") != 0 && strcmp(httpVersion, "HTTP/1.1") != 0) {
+        statusCode = 501;
+        sendErrorStatus(req, statusCode);
+        goto func_end;
+    }
+    req->http11 = strcmp(httpVersion, "HTTP/1.1") == 0;
+
+    // requestLine must begin with /
+    if(!requestURI || *requestURI != '/') {
+        statusCode = 400; // "Bad Request"
+        sendErrorStatus(req, statusCode);
+        goto func_end;
+    }
+
+    // check requestURI doesn't contain "/../"
+    // check requestURI doesn't end with "/.."
+    int uriLen = strlen(requestURI);
+    if(uriLen >= 3) {
+        char *end = requestURI + (uriLen-3);
+        if(strcmp(end, "/..") == 0 || strstr(requestURI, "/../") != NULL) {
             statusCode = 400;
-            sendErrorStatus(clntSock, statusCode);
-            goto loop_end;
+            sendErrorStatus(req, statusCode);
+            goto func_end;
         }
+    }
 
-        // only support GET requests
-        if(strcmp(method, "GET") != 0) {
-            statusCode = 501;
-            sendErrorStatus(clntSock, statusCode);
-            goto loop_end; 
+    // read the headers
+    while(1) {
+        if(fgets(line, sizeof(line), req->fp) == NULL) {
+            statusCode = 400;
+            goto func_end;
         }
+        if (strcmp("\r\n", line) == 0 || strcmp("\n", line) == 0) 
+            break;
+        parseHeader(req, line);
+    }
 
-        // only support HTTP/1.0 and 1.1
-        if(strcmp(httpVersion, "HTTP/1.0") != 0 && strcmp(httpVersion, "HTTP/1.1") != 0) {
-            statusCode = 501;
-            sendErrorStatus(clntSock, statusCode);
-            goto loop_end;
-        }
+    // a body we can't find the end of leaves the connection unusable
+    if(req->transferEncoding || req->contentLength < 0 || 
+            req->contentLength > MAX_REQUEST_BODY) {
+        statusCode = 501;
+        sendErrorStatus(req, statusCode);
+        goto func_end;
+    }
+    if(skipBody(req->fp, req->contentLength) < 0) {
+        statusCode = 400;
+        goto func_end;
+    }
 
-        // requestLine must begin with /
-        if(!requestURI || *requestURI != '/') {
-            statusCode = 400; // "Bad Request"
-            sendErrorStatus(clntSock, statusCode);
-            goto loop_end;
-        }
+    // HTTP/1.1 connections persist unless the client says otherwise,
+    // HTTP/1.0 ones only if it asks
+    if(req->http11)
+        req->keepAlive = keepAlive && !req->connectionClose;
+    else
+        req->keepAlive = keepAlive && req->connectionKeepAlive;
 
-        // check requestURI doesn't contain "/../"
-        // check requestURI doesn't end with "/.."
-        int uriLen = strlen(requestURI);
-        if(uriLen >= 3) {
-            char *end = requestURI + (uriLen-3);
-            if(strcmp(end, "/..") == 0 || strstr(requestURI, "/../") != NULL) {
-                statusCode = 400;
-                sendErrorStatus(clntSock, statusCode);
-                goto loop_end;
-            }
-        }
+    // request complete, handle
+    char *mdbURI_1 = "/mdb-lookup";
+    char *mdbURI_2 = "/mdb-lookup?";
+
+    if(strcmp(requestURI, mdbURI_1) == 0 || 
+            strncmp(requestURI, mdbURI_2, strlen(mdbURI_2)) == 0) {
+        statusCode = handleMdbRequest(req);
+        timeHist = &metrics.mdbTime;
+    }
+    else if(strcmp(requestURI, "/metrics") == 0)
+        statusCode = handleMetricsRequest(req);
+    else {
+        statusCode = handleFileRequest(webRoot, req);
+        timeHist = &metrics.staticTime;
+    }
+
+func_end:
+    if(timeHist)
+        observeDuration(timeHist, &start);
+    if(statusCode >= 0 && statusCode < 600)
+        countMetric(&metrics.requests[statusCode], 1);
+
+    fprintf(stderr, "%s \"%s %s %s\" %d %s\n",
+            inet_ntop(AF_INET, &clntAddr->sin_addr, clntIP, sizeof(clntIP)),
+            req->method, 
+            req->requestURI,
+            req->httpVersion,
+            statusCode,
+            getReason(statusCode));
+}
+
+/*
+ * returns 1 if there is something to read on the connection right
+ * away: a pipelined request in conn->fp's buffer, more bytes on the
+ * socket or the client closing it
+*/
+static int readReady(struct ClientConn *conn)
+{
+    int flags = fcntl(conn->sock, F_GETFL);
+    fcntl(conn->sock, F_SETFL, flags | O_NONBLOCK);
+    int c = getc(conn->fp);
+    int err = errno;
+    fcntl(conn->sock, F_SETFL, flags);
+
+    if(c != EOF) {
+        ungetc(c, conn->fp);
+        return 1;
+    }
+    if(ferror(conn->fp) && (err == EAGAIN || err == EWOULDBLOCK)) {
+        clearerr(conn->fp);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * answer the requests waiting on a client connection, in order, then
+ * park it until the next one arrives; it is closed instead once the
+ * client is done with it or it has carried maxRequests requests
+*/
+static void serveConn(struct ClientConn *conn)
+{
+    struct HttpRequest req;
+    req.sock = conn->sock;
+    req.fp = conn->fp;
+
+    // pipelined requests wait in req.fp's buffer until their turn
+    do {
+        conn->requests++;
+        req.keepAlive = conn->requests < maxRequests;
+        handleRequest(&req, &conn->addr, conn->requests == 1);
+    } while(req.keepAlive && readReady(conn));
+
+    if(req.keepAlive)
+        parkClientConn(&clientConns, conn);
+    else
+        closeClientConn(&clientConns, conn);
+}
+
+/*
+ * worker thread: serve the client connections that have a request
+ * waiting, one at a time
+*/
+static void *serveClients(void *unused)
+{
+    for(;;)
+        serveConn(takeClientConn(&clientConns));
+    return NULL;
+}
+
+/*
+ * print the cache counters whenever we get SIGUSR1
+ * the signal is blocked in every other thread, so it is delivered here
+*/
+static void *statsThread(void *arg)
+{
+    sigset_t *set = (sigset_t *)arg;
+    for(;;) {
+        int sig;
+        if(sigwait(set, &sig) != 0)
+            continue;
+
+        pthread_mutex_lock(&pageCache.lock);
+        unsigned long hits = pageCache.hits;
+        unsigned long lookups = hits + pageCache.misses;
+        fprintf(stderr, "page cache: %lu hits, %lu misses (%.1f%% hit ratio), "
+                "%lu evictions, %lu expirations, %zu pages, %zu of %zu bytes\n",
+                hits, pageCache.misses,
+                lookups ? 100.0 * hits / lookups : 0.0,
+                pageCache.evictions, pageCache.expirations,
+                pageCache.entries, pageCache.bytes, pageCache.budget);
+        pthread_mutex_unlock(&pageCache.lock);
+
+        pthread_mutex_lock(&lookupFlights.lock);
+        fprintf(stderr, "lookups: %lu sent to mdb-lookup-server, "
+                "%lu shared with an identical one under way\n",
+                lookupFlights.led, lookupFlights.followed);
+        pthread_mutex_unlock(&lookupFlights.lock);
+
+        pthread_mutex_lock(&fileCache.lock);
+        hits = fileCache.hits;
+        lookups = hits + fileCache.misses;
+        fprintf(stderr, "file cache: %lu hits, %lu misses (%.1f%% hit ratio), "
+                "%zu of %zu bytes\n",
+                hits, fileCache.misses,
+                lookups ? 100.0 * hits / lookups : 0.0,
+                fileCache.bytes, fileCache.budget);
+        pthread_mutex_unlock(&fileCache.lock);
+    }
+    return NULL;
+}
+
+/*
+ * block SIGUSR1 (in this thread and every thread started after it) and
+ * start the thread that reports statistics on it
+*/
+static void startStatsReporter(void)
+{
+    static sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    if(pthread_sigmask(SIG_BLOCK, &set, NULL) != 0)
+        die("pthread_sigmask() failed");
 
-        // skip all headers
-        while(1) {
-            if(fgets(line, sizeof(line), clntFp) == NULL) {
-                statusCode = 400;
-                goto loop_end;
+    pthread_t tid;
+    if(pthread_create(&tid, NULL, &statsThread, &set) != 0)
+        die("pthread_create() failed");
+    pthread_detach(tid);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-b] [-w workers] [-c connections] [-t timeout] [-i idle] [-r requests] [-f cache_mb] [-p cache_mb] [-T ttl] <server_port> <web_root> <mdb-lookup-host> <mdb-lookup-port> [<mdb-lookup-host> <mdb-lookup-port> ...]\n", prog);
+    fprintf(stderr, "  -b  use the binary protocol to mdb-lookup-server\n");
+    fprintf(stderr, "  -w  number of requests served at once (default: %d)\n", DEFAULT_WORKERS);
+    fprintf(stderr, "  -c  connections to each mdb-lookup-server, i.e. lookups run at once (default: %d)\n", DEFAULT_MDB_CONNS);
+    fprintf(stderr, "  -t  seconds to wait for mdb-lookup-server (default: %d)\n", DEFAULT_MDB_TIMEOUT);
+    fprintf(stderr, "  -i  seconds a client connection may sit idle (default: %d)\n", DEFAULT_IDLE_TIMEOUT);
+    fprintf(stderr, "  -r  requests per client connection (default: %d)\n", DEFAULT_MAX_REQUESTS);
+    fprintf(stderr, "  -f  megabytes of static files kept in memory, 0 for none (default: %d)\n", DEFAULT_FILE_CACHE_MB);
+    fprintf(stderr, "  -p  megabytes of rendered lookup pages kept in memory, 0 for none (default: %d)\n", DEFAULT_PAGE_CACHE_MB);
+    fprintf(stderr, "  -T  seconds a rendered lookup page is kept (default: %d)\n", DEFAULT_PAGE_TTL);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int workers = DEFAULT_WORKERS;
+    int mdbConns = DEFAULT_MDB_CONNS;
+    int mdbTimeout = DEFAULT_MDB_TIMEOUT;
+    int fileCacheMB = DEFAULT_FILE_CACHE_MB;
+    int pageCacheMB = DEFAULT_PAGE_CACHE_MB;
+    int pageTTL = DEFAULT_PAGE_TTL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "bw:c:t:i:r:f:p:T:")) != -1) {
+        switch(opt) {
+        case 'b':
+            mdbBinary = 1;
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            if(workers < 1 || workers > MAX_WORKERS) {
+                fprintf(stderr, "-w must be between 1 and %d\n", MAX_WORKERS);
+                usage(argv[0]);
             }
-            if (strcmp("\r\n", line) == 0 || strcmp("\n", line) == 0) 
-                break;
+            break;
+        case 'c':
+            mdbConns = atoi(optarg);
+            if(mdbConns < 1 || mdbConns > MAX_WORKERS) {
+                fprintf(stderr, "-c must be between 1 and %d\n", MAX_WORKERS);
+                usage(argv[0]);
+            }
+            break;
+        case 't':
+            mdbTimeout = atoi(optarg);
+            if(mdbTimeout < 1) {
+                fprintf(stderr, "-t must be a positive number of seconds\n");
+                usage(argv[0]);
+            }
+            break;
+        case 'i':
+            idleTimeout = atoi(optarg);
+            if(idleTimeout < 1) {
+                fprintf(stderr, "-i must be a positive number of seconds\n");
+                usage(argv[0]);
+            }
+            break;
+        case 'r':
+            maxRequests = atoi(optarg);
+            if(maxRequests < 1) {
+                fprintf(stderr, "-r must be at least 1\n");
+                usage(argv[0]);
+            }
+            break;
+        case 'f':
+            fileCacheMB = atoi(optarg);
+            if(fileCacheMB < 0) {
+                fprintf(stderr, "-f must not be negative\n");
+                usage(argv[0]);
+            }
+            break;
+        case 'p':
+            pageCacheMB = atoi(optarg);
+            if(pageCacheMB < 0) {
+                fprintf(stderr, "-p must not be negative\n");
+                usage(argv[0]);
+            }
+            break;
+        case 'T':
+            pageTTL = atoi(optarg);
+            if(pageTTL < 1) {
+                fprintf(stderr, "-T must be a positive number of seconds\n");
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
         }
+    }
+    // any number of mdb-lookup-host and mdb-lookup-port pairs
+    if(argc - optind < 4 || (argc - optind) % 2 != 0)
+        usage(argv[0]);
+    nBackends = (argc - optind - 2) / 2;
+    if(nBackends > MAX_BACKENDS) {
+        fprintf(stderr, "at most %d mdb-lookup-servers\n", MAX_BACKENDS);
+        usage(argv[0]);
+    }
 
-        // request complete, handle
-        char *mdbURI_1 = "/mdb-lookup";
-        char *mdbURI_2 = "/mdb-lookup?";
+    unsigned short servPort = atoi(argv[optind]);
+    webRoot = argv[optind + 1];
 
-        if(strcmp(requestURI, mdbURI_1) == 0 || 
-                strncmp(requestURI, mdbURI_2, strlen(mdbURI_2)) == 0)
-            statusCode = handleMdbRequest(requestURI, mdbFp, mdbSock, clntSock);
-        else
-            statusCode = handleFileRequest(webRoot, requestURI, clntSock);
+    // a client that goes away mid-response must not kill the server
+    signal(SIGPIPE, SIG_IGN);
 
-    loop_end:
-        fprintf(stderr, "%s \"%s %s %s\" %d %s\n",
-                inet_ntoa(clntAddr.sin_addr),
-                method, 
-                requestURI,
-                httpVersion,
-                statusCode,
-                getReason(statusCode));
+    // connecting to mdb-lookup-server
+    int i;
+    for(i = 0; i < nBackends; i++) {
+        const char *mdbHost = argv[optind + 2 + 2 * i];
+        unsigned short mdbPort = atoi(argv[optind + 3 + 2 * i]);
+        if(initBackend(&mdbBackends[i], mdbHost, mdbPort, mdbConns, 
+                    mdbTimeout, mdbBinary) < 0)
+            die("connecting to mdb-lookup-server failed");
+    }
+
+    if(initFileCache(&fileCache, (size_t)fileCacheMB * 1024 * 1024) < 0)
+        die("initFileCache() failed");
+    if(initPageCache(&pageCache, (size_t)pageCacheMB * 1024 * 1024, pageTTL) < 0)
+        die("initPageCache() failed");
+    initFlightGroup(&lookupFlights);
+
+    // creating server socket
+    servSock = createServerSocket(servPort);
 
-        fclose(clntFp);
+    char hostname[MAX_HOSTNAME_LEN];
+    hostname[MAX_HOSTNAME_LEN - 1] = '\0';
+    gethostname(hostname, MAX_HOSTNAME_LEN - 1);
+    struct hostent *he;
+    he = gethostbyname(hostname);
+
+    strncpy(localServerInfo.hostName, he->h_name, MAX_HOSTNAME_LEN-1);
+    localServerInfo.hostName[MAX_HOSTNAME_LEN-1] = '\0';
+    localServerInfo.port = servPort;
+
+    startStatsReporter();
+
+    // after the stats reporter, so that the poller blocks SIGUSR1 too
+    if(initClientConns(&clientConns, servSock, idleTimeout) < 0)
+        die("initClientConns() failed");
+
+    // this thread is one of the workers
+    for(i = 1; i < workers; i++) {
+        pthread_t tid;
+        if(pthread_create(&tid, NULL, &serveClients, NULL) != 0)
+            die("pthread_create() failed");
+        pthread_detach(tid);
     }
-}
\ No newline at end of file
+    serveClients(NULL);
+    return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * mdb-backend.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "mdb-proto.h"
+#include "mdb-backend.h"
+
+static void closeConn(struct MdbConn *conn)
+{
+    fclose(conn->fp); // closes the socket too
+    conn->sock = -1;
+    conn->fp = NULL;
+}
+
+/*
+ * connect conn to the backend's server, switching it to the binary
+ * protocol if the pool uses it
+ * returns 0 on success, -1 on failure
+*/
+static int connectConn(struct MdbBackend *backend, struct MdbConn *conn)
+{
+    struct addrinfo hints, *res, *ai;
+    char port[16];
+    int sock = -1;
+    int err;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", backend->port);
+    if((err = getaddrinfo(backend->host, port, &hints, &res)) != 0) {
+        fprintf(stderr, "getaddrinfo() failed: %s\n", gai_strerror(err));
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    // the timeouts bound connect() as well as every send and receive
+    struct timeval tv;
+    tv.tv_sec = backend->timeout;
+    tv.tv_usec = 0;
+
+    for(ai = res; ai != NULL; ai = ai->ai_next) {
+        if((sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+            continue;
+        if(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0 &&
+                setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0 &&
+                connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        err = errno;
+        close(sock);
+        sock = -1;
+        errno = err;
+    }
+    freeaddrinfo(res);
+    if(sock < 0)
+        return -1;
+
+    // a lookup is a single small write answered by the server; waiting
+    // to coalesce it (Nagle) would stall every lookup on a reused
+    // connection for a delayed ACK
+    int on = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    conn->sock = sock;
+    if((conn->fp = fdopen(sock, "r")) == NULL) {
+        close(sock);
+        conn->sock = -1;
+        return -1;
+    }
+
+    if(backend->binary) {
+        unsigned char hello = BinaryHello;
+        if(send(sock, &hello, 1, 0) != 1 || fgetc(conn->fp) != BinaryHello) {
+            fprintf(stderr, "mdb-lookup-server at %s:%u does not speak the binary protocol\n",
+                    backend->host, backend->port);
+            closeConn(conn);
+            errno = EPROTO;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int initBackend(struct MdbBackend *backend, const char *host,
+        unsigned short port, int size, int timeout, int binary)
+{
+    backend->host = host;
+    backend->port = port;
+    backend->binary = binary;
+    backend->timeout = timeout;
+    pthread_mutex_init(&backend->lock, NULL);
+    pthread_cond_init(&backend->idleCond, NULL);
+
+    backend->conns = (struct MdbConn *)malloc(size * sizeof(struct MdbConn));
+    if(backend->conns == NULL)
+        return -1;
+    backend->size = size;
+
+    int i;
+    backend->idle = NULL;
+    for(i = size - 1; i >= 0; i--) {
+        backend->conns[i].sock = -1;
+        backend->conns[i].fp = NULL;
+        backend->conns[i].next = backend->idle;
+        backend->idle = &backend->conns[i];
+    }
+
+    // the first connection right away, so that a wrong address shows
+    return connectConn(backend, &backend->conns[0]);
+}
+
+struct MdbConn *checkoutConn(struct MdbBackend *backend)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += backend->timeout;
+
+    pthread_mutex_lock(&backend->lock);
+    while(backend->idle == NULL) {
+        if(pthread_cond_timedwait(&backend->idleCond, &backend->lock,
+                    &deadline) == ETIMEDOUT && backend->idle == NULL) {
+            pthread_mutex_unlock(&backend->lock);
+            errno = ETIMEDOUT;
+            return NULL;
+        }
+    }
+    struct MdbConn *conn = backend->idle;
+    backend->idle = conn->next;
+    pthread_mutex_unlock(&backend->lock);
+
+    if(conn->sock < 0 && connectConn(backend, conn) < 0) {
+        int err = errno;
+        returnConn(backend, conn, 0);
+        errno = err;
+        return NULL;
+    }
+    return conn;
+}
+
+void returnConn(struct MdbBackend *backend, struct MdbConn *conn, int failed)
+{
+    if(failed && conn->sock >= 0)
+        closeConn(conn);
+
+    pthread_mutex_lock(&backend->lock);
+    if(conn->sock >= 0 || backend->idle == NULL) {
+        // connected ones first, so that they get reused
+        conn->next = backend->idle;
+        backend->idle = conn;
+    } else {
+        struct MdbConn *last = backend->idle;
+        while(last->next != NULL)
+            last = last->next;
+        conn->next = NULL;
+        last->next = conn;
+    }
+    pthread_cond_signal(&backend->idleCond);
+    pthread_mutex_unlock(&backend->lock);
+}
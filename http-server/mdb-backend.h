@@ -0,0 +1,64 @@
+/*
+ * mdb-backend.h
+*/
+
+#ifndef _MDB_BACKEND_H_
+#define _MDB_BACKEND_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+/*
+ * a connection to mdb-lookup-server
+*/
+struct MdbConn {
+    int sock;               // -1 while not connected
+    FILE *fp;               // for reading from sock
+    struct MdbConn *next;   // in the list of idle connections
+};
+
+/*
+ * a pool of connections to one mdb-lookup-server
+ *
+ * a request checks out a connection, does its lookup and returns it.
+ * connections are opened when they are first needed and reopened
+ * after a failure.  every connect, send and receive on a connection
+ * gives up after the pool's timeout.
+*/
+struct MdbBackend {
+    const char *host;
+    unsigned short port;
+    int binary;             // speak the binary protocol
+    int timeout;            // seconds
+
+    pthread_mutex_t lock;
+    pthread_cond_t idleCond;
+    struct MdbConn *idle;   // protected by lock
+    struct MdbConn *conns;  // all of them
+    int size;
+};
+
+/*
+ * set up a pool of up to size connections to host:port and open the
+ * first one
+ * returns 0 on success, -1 if the server can't be reached
+*/
+int initBackend(struct MdbBackend *backend, const char *host,
+        unsigned short port, int size, int timeout, int binary);
+
+/*
+ * take a connected connection from the pool, waiting for one to be
+ * returned if they are all in use
+ * returns NULL if none became free within the timeout (errno is then
+ * ETIMEDOUT) or connecting failed
+*/
+struct MdbConn *checkoutConn(struct MdbBackend *backend);
+
+/*
+ * hand a connection back to the pool
+ * if failed is set, the connection is closed, to be reopened by the
+ * next request that needs it
+*/
+void returnConn(struct MdbBackend *backend, struct MdbConn *conn, int failed);
+
+#endif /* _MDB_BACKEND_H_ */
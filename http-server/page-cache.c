@@ -0,0 +1,168 @@
+/*
+ * page-cache.c
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "page-cache.h"
+
+// a single page may take up at most this fraction of the budget
+#define MAX_PAGE_FRACTION 8
+
+// bytes of budget per hash bucket
+#define BYTES_PER_BUCKET 1024
+
+int initPageCache(struct PageCache *cache, size_t budget, int ttl)
+{
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->ttl = ttl;
+    if(budget == 0)
+        return 0;
+
+    size_t n = 64;
+    while(n < budget / BYTES_PER_BUCKET)
+        n *= 2;
+    cache->buckets = (struct CachedPage **)calloc(n, sizeof(struct CachedPage *));
+    if(cache->buckets == NULL)
+        return -1;
+    cache->nbuckets = n;
+    cache->budget = budget;
+    return 0;
+}
+
+static struct CachedPage **findSlot(struct PageCache *cache, const char *key)
+{
+    // FNV-1a
+    size_t h = 2166136261u;
+    const char *p;
+    for(p = key; *p; p++) {
+        h ^= (unsigned char)*p;
+        h *= 16777619u;
+    }
+
+    struct CachedPage **slot = &cache->buckets[h & (cache->nbuckets - 1)];
+    while(*slot && strcmp((*slot)->key, key) != 0)
+        slot = &(*slot)->hashNext;
+    return slot;
+}
+
+static void lruUnlink(struct PageCache *cache, struct CachedPage *page)
+{
+    if(page->lruPrev)
+        page->lruPrev->lruNext = page->lruNext;
+    else
+        cache->lruHead = page->lruNext;
+    if(page->lruNext)
+        page->lruNext->lruPrev = page->lruPrev;
+    else
+        cache->lruTail = page->lruPrev;
+}
+
+static void lruPushFront(struct PageCache *cache, struct CachedPage *page)
+{
+    page->lruPrev = NULL;
+    page->lruNext = cache->lruHead;
+    if(cache->lruHead)
+        cache->lruHead->lruPrev = page;
+    else
+        cache->lruTail = page;
+    cache->lruHead = page;
+}
+
+static void freePage(struct CachedPage *page)
+{
+    free(page->key);
+    free(page->data);
+    free(page);
+}
+
+/*
+ * take page out of the cache; it is freed once the requests still
+ * sending it are done
+ * called with the lock held
+*/
+static void removePage(struct PageCache *cache, struct CachedPage *page)
+{
+    *findSlot(cache, page->key) = page->hashNext;
+    lruUnlink(cache, page);
+    cache->bytes -= page->len;
+    cache->entries--;
+    if(--page->refs == 0)
+        freePage(page);
+}
+
+struct CachedPage *findCachedPage(struct PageCache *cache, const char *key)
+{
+    if(cache->nbuckets == 0)
+        return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    struct CachedPage *page = *findSlot(cache, key);
+    if(page && page->expires <= time(NULL)) {
+        removePage(cache, page);
+        cache->expirations++;
+        page = NULL;
+    }
+    if(page) {
+        cache->hits++;
+        lruUnlink(cache, page);
+        lruPushFront(cache, page);
+        page->refs++;
+    } else {
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return page;
+}
+
+void addCachedPage(struct PageCache *cache, const char *key,
+        const char *data, size_t len)
+{
+    if(cache->nbuckets == 0 || len > cache->budget / MAX_PAGE_FRACTION)
+        return;
+
+    struct CachedPage *page = (struct CachedPage *)calloc(1, sizeof(struct CachedPage));
+    if(page == NULL)
+        return;
+    page->key = strdup(key);
+    page->data = (char *)malloc(len > 0 ? len : 1);
+    if(page->key == NULL || page->data == NULL) {
+        freePage(page);
+        return; // it's only a cache
+    }
+    memcpy(page->data, data, len);
+    page->len = len;
+    page->expires = time(NULL) + cache->ttl;
+    page->refs = 1;
+
+    pthread_mutex_lock(&cache->lock);
+
+    struct CachedPage **slot = findSlot(cache, key);
+    if(*slot)
+        removePage(cache, *slot); // someone else got there first
+
+    while(cache->bytes + len > cache->budget && cache->lruTail) {
+        removePage(cache, cache->lruTail);
+        cache->evictions++;
+    }
+
+    slot = findSlot(cache, key);
+    page->hashNext = *slot;
+    *slot = page;
+    lruPushFront(cache, page);
+    cache->bytes += len;
+    cache->entries++;
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void releaseCachedPage(struct PageCache *cache, struct CachedPage *page)
+{
+    pthread_mutex_lock(&cache->lock);
+    int refs = --page->refs;
+    pthread_mutex_unlock(&cache->lock);
+    if(refs == 0)
+        freePage(page);
+}
@@ -0,0 +1,78 @@
+/*
+ * page-cache.h
+*/
+
+#ifndef _PAGE_CACHE_H_
+#define _PAGE_CACHE_H_
+
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * a rendered /mdb-lookup?key= page
+*/
+struct CachedPage {
+    char *key;              // the decoded lookup key
+    char *data;             // the HTML page
+    size_t len;
+    time_t expires;
+
+    int refs;               // requests sending it, plus one while cached
+    struct CachedPage *hashNext;
+    struct CachedPage *lruPrev;
+    struct CachedPage *lruNext;
+};
+
+/*
+ * a cache of rendered lookup pages, keyed by lookup key
+ *
+ * it holds at most budget bytes of pages and evicts the least recently
+ * used ones first.  a page is served for ttl seconds after it was
+ * rendered; mdb-lookup-server may have reloaded its database since,
+ * so after that the lookup is done again.
+*/
+struct PageCache {
+    pthread_mutex_t lock;
+    int ttl;                // seconds
+
+    // all protected by lock
+    struct CachedPage **buckets;
+    size_t nbuckets;        // a power of two; 0 if disabled
+    struct CachedPage *lruHead;
+    struct CachedPage *lruTail;
+    size_t bytes;
+    size_t budget;
+    size_t entries;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;    // to stay within the budget
+    unsigned long expirations;
+};
+
+/*
+ * set up a cache of up to budget bytes of pages, each kept for ttl
+ * seconds; a budget of 0 disables it
+ * returns 0 on success, -1 if memory could not be allocated
+*/
+int initPageCache(struct PageCache *cache, size_t budget, int ttl);
+
+/*
+ * the page for key, if there is one that hasn't expired
+ * returns NULL otherwise
+*/
+struct CachedPage *findCachedPage(struct PageCache *cache, const char *key);
+
+/*
+ * store a copy of the page for key, replacing any older one
+ * pages larger than 1/8 of the budget are not cached
+*/
+void addCachedPage(struct PageCache *cache, const char *key,
+        const char *data, size_t len);
+
+/*
+ * done with a page returned by findCachedPage()
+*/
+void releaseCachedPage(struct PageCache *cache, struct CachedPage *page);
+
+#endif /* _PAGE_CACHE_H_ */
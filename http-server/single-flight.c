@@ -0,0 +1,93 @@
+/*
+ * single-flight.c
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "single-flight.h"
+
+void initFlightGroup(struct FlightGroup *group)
+{
+    memset(group, 0, sizeof(*group));
+    pthread_mutex_init(&group->lock, NULL);
+}
+
+struct Flight *joinFlight(struct FlightGroup *group, const char *key, int *leader)
+{
+    pthread_mutex_lock(&group->lock);
+
+    // there are never more flights than workers, so a list will do
+    struct Flight *flight;
+    for(flight = group->flights; flight != NULL; flight = flight->next) {
+        if(strcmp(flight->key, key) == 0)
+            break;
+    }
+
+    if(flight) {
+        *leader = 0;
+        flight->refs++;
+        group->followed++;
+        pthread_mutex_unlock(&group->lock);
+        return flight;
+    }
+
+    flight = (struct Flight *)calloc(1, sizeof(struct Flight));
+    if(flight == NULL || (flight->key = strdup(key)) == NULL) {
+        pthread_mutex_unlock(&group->lock);
+        free(flight);
+        return NULL;
+    }
+    pthread_cond_init(&flight->doneCond, NULL);
+    flight->refs = 1;
+    flight->next = group->flights;
+    group->flights = flight;
+    group->led++;
+    *leader = 1;
+
+    pthread_mutex_unlock(&group->lock);
+    return flight;
+}
+
+void finishFlight(struct FlightGroup *group, struct Flight *flight,
+        int status, char *data, size_t len)
+{
+    pthread_mutex_lock(&group->lock);
+
+    struct Flight **p = &group->flights;
+    while(*p != flight)
+        p = &(*p)->next;
+    *p = flight->next;
+
+    flight->done = 1;
+    flight->status = status;
+    flight->data = data;
+    flight->len = len;
+    pthread_cond_broadcast(&flight->doneCond);
+
+    pthread_mutex_unlock(&group->lock);
+}
+
+int waitFlight(struct FlightGroup *group, struct Flight *flight)
+{
+    pthread_mutex_lock(&group->lock);
+    while(!flight->done)
+        pthread_cond_wait(&flight->doneCond, &group->lock);
+    int status = flight->status;
+    pthread_mutex_unlock(&group->lock);
+    return status;
+}
+
+void leaveFlight(struct FlightGroup *group, struct Flight *flight)
+{
+    pthread_mutex_lock(&group->lock);
+    int refs = --flight->refs;
+    pthread_mutex_unlock(&group->lock);
+
+    if(refs == 0) {
+        pthread_cond_destroy(&flight->doneCond);
+        free(flight->key);
+        free(flight->data);
+        free(flight);
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * single-flight.h
+*/
+
+#ifndef _SINGLE_FLIGHT_H_
+#define _SINGLE_FLIGHT_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * one piece of work under way, and its result once it is done
+*/
+struct Flight {
+    char *key;
+    int done;
+    int status;             // as set by the leader
+    char *data;             // the result, owned by the flight
+    size_t len;
+
+    int refs;               // the leader and the followers
+    pthread_cond_t doneCond;
+    struct Flight *next;    // in the group, while not done
+};
+
+/*
+ * a set of pieces of work, each identified by a key, that are done at
+ * most once at a time
+ *
+ * the first request for a key leads: it does the work and publishes
+ * the result.  requests for the same key that arrive meanwhile follow:
+ * they wait for the leader and share its result.  once the result is
+ * published, the next request for the key leads a new flight.
+*/
+struct FlightGroup {
+    pthread_mutex_t lock;
+
+    // protected by lock
+    struct Flight *flights;
+    unsigned long led;
+    unsigned long followed;
+};
+
+void initFlightGroup(struct FlightGroup *group);
+
+/*
+ * join the flight for key, starting one if there is none
+ * *leader is set if the caller leads it, and must call finishFlight()
+ * returns NULL if memory could not be allocated
+*/
+struct Flight *joinFlight(struct FlightGroup *group, const char *key, int *leader);
+
+/*
+ * publish the result of a flight and wake up its followers
+ * the flight takes over data, which must come from malloc()
+*/
+void finishFlight(struct FlightGroup *group, struct Flight *flight,
+        int status, char *data, size_t len);
+
+/*
+ * wait for the leader to finish the flight
+ * returns its status
+*/
+int waitFlight(struct FlightGroup *group, struct Flight *flight);
+
+/*
+ * done with a flight; the last one to leave frees it
+*/
+void leaveFlight(struct FlightGroup *group, struct Flight *flight);
+
+#endif /* _SINGLE_FLIGHT_H_ */
@@ -0,0 +1,267 @@
+/*
+ * mylist-bench.c
+ *
+ * Times the operations of libmylist on lists of 1e3, 1e4, ... items, up
+ * to the number given on the command line (1e7 by default), and prints
+ * the nanoseconds and the malloc() and free() calls per operation.
+ *
+ * For the functions that add one item, an operation is one call.  For
+ * the ones that go through the whole list (traverseList(), findNode()
+ * of an item that isn't there, reverseList(), removeAllNodes()), it is
+ * one item of the list, so that the numbers can be compared across
+ * sizes.
+ *
+ * The nodes of a freshly built List lie next to each other in memory,
+ * which a list that has grown and shrunk for a while can't count on, so
+ * traversal is also timed after the nodes have been relinked in random
+ * order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mylist.h"
+#include "mylist-unrolled.h"
+
+// items gone through per measurement of a whole-list operation,
+// whatever the size of the list
+#define ITEMS_PER_RUN 10000000L
+
+// addBack() takes O(n) per call, so it is only timed up to this size
+#define ADD_BACK_MAX 10000L
+
+/*
+ * malloc() and free() calls are counted by linking with
+ * -Wl,--wrap=malloc,--wrap=free, which sends the calls made by the
+ * library and by this file through these.
+ */
+void *__real_malloc(size_t size);
+void __real_free(void *ptr);
+
+static long mallocs;
+static long frees;
+
+void *__wrap_malloc(size_t size)
+{
+    mallocs++;
+    return __real_malloc(size);
+}
+
+void __wrap_free(void *ptr)
+{
+    frees++;
+    __real_free(ptr);
+}
+
+static double sum;
+
+static void addDouble(void *p)
+{
+    sum += *(double *)p;
+}
+
+static void die(const char *message)
+{
+    perror(message);
+    exit(1);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * The clock and the allocation counters at the start of a measurement.
+ */
+struct Timing {
+    double start;
+    long mallocs;
+    long frees;
+};
+
+static void startTiming(struct Timing *t)
+{
+    t->mallocs = mallocs;
+    t->frees = frees;
+    t->start = now();
+}
+
+/*
+ * Print what was measured since startTiming(), over 'ops' operations
+ * on a list of n items.
+ */
+static void report(struct Timing *t, const char *what, long n, long ops)
+{
+    double elapsed = now() - t->start;
+    printf("%-28s %9ld %10.2f %10.3f %10.3f\n", what, n,
+	    elapsed * 1e9 / ops, (double)(mallocs - t->mallocs) / ops,
+	    (double)(frees - t->frees) / ops);
+}
+
+/*
+ * Relink the n nodes of the list in random order.
+ */
+static void shuffleList(struct List *list, long n)
+{
+    struct Node **nodes = (struct Node **)malloc(n * sizeof(struct Node *));
+    if (nodes == NULL)
+	die("malloc() failed");
+
+    long i;
+    struct Node *node = list->head;
+    for (i = 0; i < n; i++) {
+	nodes[i] = node;
+	node = node->next;
+    }
+    for (i = n - 1; i > 0; i--) {
+	long j = random() % (i + 1);
+	struct Node *tmp = nodes[i];
+	nodes[i] = nodes[j];
+	nodes[j] = tmp;
+    }
+    for (i = 0; i < n - 1; i++)
+	nodes[i]->next = nodes[i + 1];
+    nodes[n - 1]->next = NULL;
+    list->head = nodes[0];
+    free(nodes);
+}
+
+/*
+ * Time every operation on lists of n items of 'a'.
+ */
+static void benchSize(double *a, long n)
+{
+    long rounds = ITEMS_PER_RUN / n > 0 ? ITEMS_PER_RUN / n : 1;
+    long i, r;
+    struct Timing t;
+    struct List list;
+    struct Node *node;
+    double missing = -1;
+
+    initList(&list);
+    startTiming(&t);
+    for (i = 0; i < n; i++) {
+	if (addFront(&list, a+i) == NULL)
+	    die("addFront() failed");
+    }
+    report(&t, "addFront", n, n);
+
+    startTiming(&t);
+    for (r = 0; r < rounds; r++)
+	traverseList(&list, &addDouble);
+    report(&t, "traverseList", n, n * rounds);
+
+    startTiming(&t);
+    for (r = 0; r < rounds; r++) {
+	if (findNode(&list, &missing, &compareDouble) != NULL)
+	    die("findNode() found a missing item");
+    }
+    report(&t, "findNode (missing)", n, n * rounds);
+
+    startTiming(&t);
+    for (r = 0; r < rounds; r++)
+	reverseList(&list);
+    report(&t, "reverseList", n, n * rounds);
+
+    startTiming(&t);
+    removeAllNodes(&list);
+    report(&t, "removeAllNodes", n, n);
+
+    startTiming(&t);
+    node = NULL;
+    for (i = 0; i < n; i++) {
+	if ((node = addAfter(&list, node, a+i)) == NULL)
+	    die("addAfter() failed");
+    }
+    report(&t, "addAfter (appending)", n, n);
+    removeAllNodes(&list);
+
+    if (n <= ADD_BACK_MAX) {
+	startTiming(&t);
+	for (i = 0; i < n; i++) {
+	    if (addBack(&list, a+i) == NULL)
+		die("addBack() failed");
+	}
+	report(&t, "addBack", n, n);
+	removeAllNodes(&list);
+    }
+
+    struct NodePool pool;
+    initNodePool(&pool, 0);
+    initListWithPool(&list, &pool);
+    startTiming(&t);
+    for (i = 0; i < n; i++) {
+	if (addFront(&list, a+i) == NULL)
+	    die("addFront() failed");
+    }
+    report(&t, "addFront (pool)", n, n);
+
+    startTiming(&t);
+    removeAllNodes(&list);
+    report(&t, "removeAllNodes (pool)", n, n);
+
+    struct UnrolledList ulist;
+    initUnrolledList(&ulist);
+    startTiming(&t);
+    for (i = 0; i < n; i++) {
+	if (addBackUnrolled(&ulist, a+i) < 0)
+	    die("addBackUnrolled() failed");
+    }
+    report(&t, "addBackUnrolled", n, n);
+
+    startTiming(&t);
+    for (r = 0; r < rounds; r++)
+	traverseUnrolledList(&ulist, &addDouble);
+    report(&t, "traverseUnrolledList", n, n * rounds);
+
+    startTiming(&t);
+    removeAllUnrolled(&ulist);
+    report(&t, "removeAllUnrolled", n, n);
+
+    // last, since freeing nodes in random order leaves the heap
+    // fragmented, which slows down what allocates after it
+    initList(&list);
+    for (i = 0; i < n; i++) {
+	if (addFront(&list, a+i) == NULL)
+	    die("addFront() failed");
+    }
+    shuffleList(&list, n);
+    startTiming(&t);
+    for (r = 0; r < rounds; r++)
+	traverseList(&list, &addDouble);
+    report(&t, "traverseList (shuffled)", n, n * rounds);
+
+    startTiming(&t);
+    removeAllNodes(&list);
+    report(&t, "removeAllNodes (shuffled)", n, n);
+}
+
+int main(int argc, char **argv)
+{
+    long max = argc > 1 ? atol(argv[1]) : 10000000;
+    if (max < 1000) {
+	fprintf(stderr, "usage: %s [max-items (at least 1000)]\n", argv[0]);
+	exit(1);
+    }
+
+    double *a = (double *)malloc(max * sizeof(double));
+    if (a == NULL)
+	die("malloc() failed");
+    long i;
+    for (i = 0; i < max; i++)
+	a[i] = i;
+
+    printf("%-28s %9s %10s %10s %10s\n",
+	    "operation", "items", "ns/op", "mallocs/op", "frees/op");
+    long n;
+    for (n = 1000; n <= max; n *= 10)
+	benchSize(a, n);
+
+    free(a);
+
+    // so that the traversals can't be optimized away
+    return sum < 0;
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include "mylist.h"
+#include "mylist-unrolled.h"
 
 static void printDouble(void *p)
 {
@@ -23,6 +24,9 @@ int main()
     double x;
     void *data;
     struct Node *node;
+    struct NodePool pool;
+    struct UnrolledList ulist;
+    struct UnrolledPos pos;
 
     // initialize list
     struct List list;
@@ -101,5 +105,70 @@ int main()
 	printf("]\n");
     }
 
+    // test a list whose nodes come from a pool, 4 to a chunk
+    printf("testing initListWithPool(): ");
+    initNodePool(&pool, 4);
+    initListWithPool(&list, &pool);
+    for (i = 0; i < n; i++) {
+	if (addBack(&list, a+i) == NULL) 
+	    die("addBack() failed");
+    }
+    popFront(&list);
+    popFront(&list);
+    // these two reuse the popped nodes
+    addFront(&list, a+1);
+    addFront(&list, a);
+    assert(pool.used == 1);
+    traverseList(&list, &printDouble);
+    printf("\n");
+
+    printf("testing removeAllNodes() with a pool: ");
+    removeAllNodes(&list);
+    assert(pool.chunks == NULL);
+    traverseList(&list, &printDouble);
+    printf("\n");
+
+    // test the unrolled list, with more items than fit in a node
+    initUnrolledList(&ulist);
+    printf("testing addBackUnrolled() and addFrontUnrolled(): ");
+    for (i = 0; i < n; i++) {
+	if (addBackUnrolled(&ulist, a+i) < 0 || addFrontUnrolled(&ulist, a+i) < 0)
+	    die("addBackUnrolled() failed");
+    }
+    traverseUnrolledList(&ulist, &printDouble);
+    printf("\n");
+
+    printf("testing findUnrolled(): ");
+    x = 3.5;
+    pos = findUnrolled(&ulist, &x, &compareDouble);
+    assert(pos.node == NULL);
+    x = 8.0;
+    pos = findUnrolled(&ulist, &x, &compareDouble);
+    assert(pos.node != NULL && *(double *)pos.node->data[pos.index] == x);
+    printf("OK\n");
+
+    printf("testing addAfterUnrolled(): ");
+    // right after the first 8.0
+    pos = addAfterUnrolled(&ulist, pos, &x);
+    assert(pos.node != NULL && pos.node->data[pos.index] == &x);
+    traverseUnrolledList(&ulist, &printDouble);
+    printf("\n");
+
+    printf("testing reverseUnrolledList(): ");
+    reverseUnrolledList(&ulist);
+    traverseUnrolledList(&ulist, &printDouble);
+    printf("\n");
+
+    printf("testing popFrontUnrolled(): ");
+    for (i = 0; i < n; i++)
+	printf("%.1f ", *(double *)popFrontUnrolled(&ulist));
+    printf("\n");
+
+    printf("testing removeAllUnrolled(): ");
+    removeAllUnrolled(&ulist);
+    assert(isEmptyUnrolledList(&ulist) && popFrontUnrolled(&ulist) == NULL);
+    traverseUnrolledList(&ulist, &printDouble);
+    printf("\n");
+
     return 0;
 }
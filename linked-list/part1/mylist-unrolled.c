@@ -0,0 +1,188 @@
+/*
+ * mylist-unrolled.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mylist-unrolled.h"
+
+static struct UnrolledNode *newNode(void)
+{
+    struct UnrolledNode *node =
+	(struct UnrolledNode *)malloc(sizeof(struct UnrolledNode));
+    if (node == NULL)
+	return NULL;
+    node->next = NULL;
+    node->count = 0;
+    return node;
+}
+
+int addFrontUnrolled(struct UnrolledList *list, void *data)
+{
+    struct UnrolledNode *node = list->head;
+
+    if (node == NULL || node->count == UNROLLED_NODE_SLOTS) {
+	if ((node = newNode()) == NULL)
+	    return -1;
+	node->next = list->head;
+	list->head = node;
+	if (list->tail == NULL)
+	    list->tail = node;
+    }
+
+    memmove(&node->data[1], &node->data[0], node->count * sizeof(void *));
+    node->data[0] = data;
+    node->count++;
+    return 0;
+}
+
+int addBackUnrolled(struct UnrolledList *list, void *data)
+{
+    struct UnrolledNode *node = list->tail;
+
+    if (node == NULL || node->count == UNROLLED_NODE_SLOTS) {
+	if ((node = newNode()) == NULL)
+	    return -1;
+	if (list->tail)
+	    list->tail->next = node;
+	else
+	    list->head = node;
+	list->tail = node;
+    }
+
+    node->data[node->count++] = data;
+    return 0;
+}
+
+struct UnrolledPos addAfterUnrolled(struct UnrolledList *list,
+	struct UnrolledPos prev, void *data)
+{
+    struct UnrolledPos pos = { NULL, 0 };
+
+    if (prev.node == NULL) {
+	if (addFrontUnrolled(list, data) == 0)
+	    pos.node = list->head;
+	return pos;
+    }
+
+    struct UnrolledNode *node = prev.node;
+    int index = prev.index + 1;
+
+    // a full node is split in two, the second half going to a new node
+    // after it; the new item then goes into whichever half it falls in
+    if (node->count == UNROLLED_NODE_SLOTS) {
+	struct UnrolledNode *second = newNode();
+	if (second == NULL)
+	    return pos;
+	int half = UNROLLED_NODE_SLOTS / 2;
+	second->count = node->count - half;
+	memcpy(second->data, &node->data[half], second->count * sizeof(void *));
+	node->count = half;
+	second->next = node->next;
+	node->next = second;
+	if (list->tail == node)
+	    list->tail = second;
+
+	if (index > half) {
+	    node = second;
+	    index -= half;
+	}
+    }
+
+    memmove(&node->data[index + 1], &node->data[index],
+	    (node->count - index) * sizeof(void *));
+    node->data[index] = data;
+    node->count++;
+
+    pos.node = node;
+    pos.index = index;
+    return pos;
+}
+
+void traverseUnrolledList(struct UnrolledList *list, void (*f)(void *))
+{
+    struct UnrolledNode *node = list->head;
+    while (node) {
+	int i;
+	for (i = 0; i < node->count; i++)
+	    f(node->data[i]);
+	node = node->next;
+    }
+}
+
+struct UnrolledPos findUnrolled(struct UnrolledList *list,
+	const void *dataSought, int (*compar)(const void *, const void *))
+{
+    struct UnrolledPos pos = { NULL, 0 };
+    struct UnrolledNode *node = list->head;
+    while (node) {
+	int i;
+	for (i = 0; i < node->count; i++) {
+	    if (compar(dataSought, node->data[i]) == 0) {
+		pos.node = node;
+		pos.index = i;
+		return pos;
+	    }
+	}
+	node = node->next;
+    }
+    return pos;
+}
+
+void *popFrontUnrolled(struct UnrolledList *list)
+{
+    struct UnrolledNode *node = list->head;
+    if (node == NULL)
+	return NULL;
+
+    void *data = node->data[0];
+    node->count--;
+    if (node->count > 0) {
+	memmove(&node->data[0], &node->data[1], node->count * sizeof(void *));
+	return data;
+    }
+
+    list->head = node->next;
+    if (list->head == NULL)
+	list->tail = NULL;
+    free(node);
+    return data;
+}
+
+void removeAllUnrolled(struct UnrolledList *list)
+{
+    struct UnrolledNode *node = list->head;
+    while (node) {
+	struct UnrolledNode *next = node->next;
+	free(node);
+	node = next;
+    }
+    list->head = NULL;
+    list->tail = NULL;
+}
+
+void reverseUnrolledList(struct UnrolledList *list)
+{
+    struct UnrolledNode *prv = NULL;
+    struct UnrolledNode *cur = list->head;
+    struct UnrolledNode *nxt;
+
+    list->tail = cur;
+    while (cur) {
+	// reverse the items within the node, then the node in the list
+	int i, j;
+	for (i = 0, j = cur->count - 1; i < j; i++, j--) {
+	    void *tmp = cur->data[i];
+	    cur->data[i] = cur->data[j];
+	    cur->data[j] = tmp;
+	}
+
+	nxt = cur->next;
+	cur->next = prv;
+	prv = cur;
+	cur = nxt;
+    }
+
+    list->head = prv;
+}
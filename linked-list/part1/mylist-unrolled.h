@@ -0,0 +1,117 @@
+#ifndef _MYLIST_UNROLLED_H_
+#define _MYLIST_UNROLLED_H_
+
+/*
+ * The number of data pointers in a node of an unrolled list.  With the
+ * next pointer and the count, a node takes 128 bytes: two cache lines.
+ */
+#define UNROLLED_NODE_SLOTS 14
+
+/*
+ * A node in an unrolled linked list: up to UNROLLED_NODE_SLOTS data
+ * pointers, in order, in data[0] to data[count - 1].  A node in a list
+ * is never empty.
+ */
+struct UnrolledNode {
+    struct UnrolledNode *next;
+    int count;
+    void *data[UNROLLED_NODE_SLOTS];
+};
+
+/*
+ * An unrolled linked list: a linked list that keeps many data pointers
+ * in each node, so that going through it reads contiguous memory
+ * rather than following a pointer for every item.
+ * 'head' points to the first node in the list, 'tail' to the last.
+ */
+struct UnrolledList {
+    struct UnrolledNode *head;
+    struct UnrolledNode *tail;
+};
+
+/*
+ * The place of a data item in an unrolled list: data[index] of 'node'.
+ * 'node' is NULL for no item.
+ */
+struct UnrolledPos {
+    struct UnrolledNode *node;
+    int index;
+};
+
+/*
+ * Initialize an empty list.
+ */
+static inline void initUnrolledList(struct UnrolledList *list)
+{
+    list->head = 0;
+    list->tail = 0;
+}
+
+/*
+ * Returns 1 if the list is empty, 0 otherwise.
+ */
+static inline int isEmptyUnrolledList(struct UnrolledList *list)
+{
+    return (list->head == 0);
+}
+
+/*
+ * The functions below work like their counterparts for struct List in
+ * mylist.h, except that an item is found by its UnrolledPos rather
+ * than by its node.  A position is only good until the list is next
+ * changed.
+ */
+
+/*
+ * Add the data pointer to the front of the list.
+ * Returns 0 on success and -1 on failure.
+ */
+int addFrontUnrolled(struct UnrolledList *list, void *data);
+
+/*
+ * Add the data pointer to the end of the list.  Unlike addBack(), this
+ * takes constant time.
+ * Returns 0 on success and -1 on failure.
+ */
+int addBackUnrolled(struct UnrolledList *list, void *data);
+
+/*
+ * Add the data pointer right after the item at 'prev', or at the front
+ * of the list if prev.node is NULL.
+ * Returns the position of the new item, whose node is NULL on failure.
+ */
+struct UnrolledPos addAfterUnrolled(struct UnrolledList *list,
+	struct UnrolledPos prev, void *data);
+
+/*
+ * Traverse the list, calling f() with each data item.
+ */
+void traverseUnrolledList(struct UnrolledList *list, void (*f)(void *));
+
+/*
+ * Traverse the list, comparing each data item with 'dataSought' using
+ * 'compar' function, as findNode() does.
+ * Returns the position of the first matching item; its node is NULL
+ * if there is none.
+ */
+struct UnrolledPos findUnrolled(struct UnrolledList *list,
+	const void *dataSought, int (*compar)(const void *, const void *));
+
+/*
+ * Remove the first item from the list and return it.
+ * Returns NULL if the list is empty.
+ */
+void *popFrontUnrolled(struct UnrolledList *list);
+
+/*
+ * Remove all items from the list, deallocating the memory for the
+ * nodes.
+ */
+void removeAllUnrolled(struct UnrolledList *list);
+
+/*
+ * Reverse the list.  Like reverseList(), this does not allocate memory.
+ */
+void reverseUnrolledList(struct UnrolledList *list);
+
+#endif /* #ifndef _MYLIST_UNROLLED_H_ */
@@ -6,9 +6,77 @@
 #include <stdlib.h>
 #include "mylist.h"
 
+/*
+ * A block of nodes allocated at once for a NodePool.
+ */
+struct NodeChunk {
+    struct NodeChunk *next;
+    struct Node nodes[];
+};
+
+void initNodePool(struct NodePool *pool, int chunkNodes)
+{
+    pool->chunks = NULL;
+    pool->free = NULL;
+    pool->used = 0;
+    pool->chunkNodes = chunkNodes > 0 ? chunkNodes : NODE_POOL_CHUNK;
+}
+
+void freeNodePool(struct NodePool *pool)
+{
+    while (pool->chunks) {
+	struct NodeChunk *chunk = pool->chunks;
+	pool->chunks = chunk->next;
+	free(chunk);
+    }
+    pool->free = NULL;
+    pool->used = 0;
+}
+
+/*
+ * Get memory for a node of the list: from its pool if it has one,
+ * from malloc() otherwise.  Returns NULL on failure.
+ */
+static struct Node *allocNode(struct List *list)
+{
+    struct NodePool *pool = list->pool;
+    if (pool == NULL)
+	return (struct Node *)malloc(sizeof(struct Node));
+
+    if (pool->free) {
+	struct Node *node = pool->free;
+	pool->free = node->next;
+	return node;
+    }
+    if (pool->chunks == NULL || pool->used == pool->chunkNodes) {
+	struct NodeChunk *chunk = (struct NodeChunk *)malloc(
+		sizeof(struct NodeChunk) + pool->chunkNodes * sizeof(struct Node));
+	if (chunk == NULL)
+	    return NULL;
+	chunk->next = pool->chunks;
+	pool->chunks = chunk;
+	pool->used = 0;
+    }
+    return &pool->chunks->nodes[pool->used++];
+}
+
+/*
+ * Give back the memory of a node that was removed from the list.
+ */
+static void freeNode(struct List *list, struct Node *node)
+{
+    struct NodePool *pool = list->pool;
+    if (pool == NULL) {
+	free(node);
+	return;
+    }
+    node->next = pool->free;
+    pool->free = node;
+}
+
 struct Node *addFront(struct List *list, void *data)
 {
-    struct Node *node = (struct Node *)malloc(sizeof(struct Node));
+    struct Node *node = allocNode(list);
     if (node == NULL)
 	return NULL;
 
@@ -60,12 +128,18 @@ void *popFront(struct List *list)
     struct Node *oldHead = list->head;
     list->head = oldHead->next;
     void *data = oldHead->data;
-    free(oldHead);
+    freeNode(list, oldHead);
     return data;
 }
 
 void removeAllNodes(struct List *list)
 {
+    if (list->pool) {
+	freeNodePool(list->pool);
+	list->head = NULL;
+	return;
+    }
+
     while (!isEmptyList(list))
 	popFront(list);
 }
@@ -76,7 +150,7 @@ struct Node *addAfter(struct List *list,
     if (prevNode == NULL)
 	return addFront(list, data);
 
-    struct Node *node = (struct Node *)malloc(sizeof(struct Node));
+    struct Node *node = allocNode(list);
     if (node == NULL)
 	return NULL;
 
@@ -105,7 +179,7 @@ void reverseList(struct List *list)
 struct Node *addBack(struct List *list, void *data)
 {
     // make the new node that will go to the end of list
-    struct Node *node = (struct Node *)malloc(sizeof(struct Node));
+    struct Node *node = allocNode(list);
     if (node == NULL)
 	return NULL;
     node->data = data;
@@ -9,12 +9,33 @@ struct Node {
     struct Node *next;
 };
 
+/*
+ * A pool that the nodes of one list are carved out of, 'chunkNodes' at
+ * a time, instead of being malloc()ed one by one.  Nodes that are
+ * removed from the list are kept in the pool to be reused, and all of
+ * them are given back at once, a chunk at a time, when the list is
+ * emptied with removeAllNodes() or the pool is freed.
+ */
+struct NodeChunk;
+
+struct NodePool {
+    struct NodeChunk *chunks;	// newest first
+    struct Node *free;		// nodes removed from the list
+    int used;			// nodes carved out of the newest chunk
+    int chunkNodes;
+};
+
+// nodes per chunk if initNodePool() is given 0
+#define NODE_POOL_CHUNK 1024
+
 /*
  * A linked list.  
  * 'head' points to the first node in the list.
+ * 'pool' is where its nodes come from, or NULL if they are malloc()ed.
  */
 struct List {
     struct Node *head;
+    struct NodePool *pool;
 };
 
 /*
@@ -23,6 +44,32 @@ struct List {
 static inline void initList(struct List *list)
 {
     list->head = 0;
+    list->pool = 0;
+}
+
+/*
+ * Initialize an empty pool of chunks of 'chunkNodes' nodes each, or of
+ * NODE_POOL_CHUNK nodes if 'chunkNodes' is 0.  Nothing is allocated
+ * until the first node is needed.
+ */
+void initNodePool(struct NodePool *pool, int chunkNodes);
+
+/*
+ * Deallocate all the nodes of the pool, whether in a list or not, in
+ * time proportional to the number of chunks.  The pool is empty
+ * afterwards, and can be used again.
+ */
+void freeNodePool(struct NodePool *pool);
+
+/*
+ * Initialize an empty list whose nodes come from 'pool'.  A pool
+ * serves only one list, since removeAllNodes() hands all of its nodes
+ * back.
+ */
+static inline void initListWithPool(struct List *list, struct NodePool *pool)
+{
+    list->head = 0;
+    list->pool = pool;
 }
 
 /*
@@ -102,6 +149,9 @@ void *popFront(struct List *list);
 /*
  * Remove all nodes from the list, deallocating the memory for the
  * nodes.  You can implement this function using popFront().
+ *
+ * For a list with a pool, this frees the whole pool with
+ * freeNodePool() rather than the nodes one by one.
  */
 void removeAllNodes(struct List *list);
 
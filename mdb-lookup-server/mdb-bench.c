@@ -0,0 +1,428 @@
+/*
+ * mdb-bench.c
+ *
+ * Load generator for mdb-lookup-server: replays the keys of a key file
+ * (one per line, as written by mdb-gen -K) over several connections
+ * for a while, and reports the throughput and the latency percentiles.
+ *
+ * By default every connection sends its next key as soon as it has
+ * read the answer to the previous one (a closed loop), which measures
+ * how fast the server can go.  With -r, the connections together send
+ * 'rate' lookups a second on a fixed schedule (an open loop), which
+ * measures the latency clients see at that load: a lookup's latency is
+ * counted from when it was due to be sent, so that time spent waiting
+ * behind a slow answer is not left out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "mdb-proto.h"
+#include "mdb-conn.h"
+
+// how long to keep trying to connect, so that the benchmark can be
+// started along with a server that is still loading its database
+#define ConnectTries 100
+#define ConnectRetryNanos 100000000L
+
+static void die(const char *s) { perror(s); exit(1); }
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-b] [-c connections] [-d seconds] "
+            "[-r rate] -k key-file <server-host> <server-port>\n", prog);
+    fprintf(stderr, "  -b  speak the binary protocol (see mdb-proto.h)\n");
+    fprintf(stderr, "  -c  number of connections, each in its own thread "
+            "(default: 4)\n");
+    fprintf(stderr, "  -d  how long to run, in seconds (default: 5)\n");
+    fprintf(stderr, "  -r  send this many lookups a second in all "
+            "(open loop)\n      instead of each as soon as the last "
+            "one is answered (closed loop)\n");
+    fprintf(stderr, "  -k  the keys to look up, one per line\n");
+    exit(1);
+}
+
+/*
+ * Parse a decimal number between 1 and 'max'.
+ * Returns -1 if 'arg' is not one.
+ */
+static long parsePositive(const char *arg, long max)
+{
+    char *end;
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (errno || end == arg || *end != '\0' || n < 1 || n > max)
+        return -1;
+    return n;
+}
+
+static int64_t nowNanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleepUntil(int64_t nanos)
+{
+    struct timespec ts;
+    ts.tv_sec = nanos / 1000000000;
+    ts.tv_nsec = nanos % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/*
+ * What every connection shares: the server, the keys and the schedule.
+ */
+struct BenchConfig {
+    const char *host;
+    const char *port;
+    int binary;
+    char **keys;
+    int nkeys;
+    int64_t start;      // when the connections start sending
+    int64_t end;        // when they stop
+    int64_t interval;   // between lookups on a connection; 0 for closed loop
+};
+
+/*
+ * One connection and what it measured.
+ */
+struct BenchConn {
+    const struct BenchConfig *config;
+    int firstKey;       // where in the keys it starts
+    int64_t offset;     // of its schedule, so that they don't all send at once
+
+    int64_t *latencies; // nanoseconds, one per answered lookup
+    long count;
+    long cap;
+    long errors;        // lookups that went unanswered
+    long records;       // records received
+};
+
+static int connectServer(const struct BenchConfig *config)
+{
+    struct addrinfo hints, *res, *ai;
+    int err, tries;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((err = getaddrinfo(config->host, config->port, &hints, &res)) != 0) {
+        fprintf(stderr, "getaddrinfo() failed: %s\n", gai_strerror(err));
+        exit(1);
+    }
+
+    for (tries = 0; tries < ConnectTries; tries++) {
+        for (ai = res; ai != NULL; ai = ai->ai_next) {
+            int sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (sock < 0)
+                die("socket() failed");
+            if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) {
+                int on = 1;
+                setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                freeaddrinfo(res);
+                return sock;
+            }
+            err = errno;
+            close(sock);
+            errno = err;
+        }
+        if (errno != ECONNREFUSED)
+            break;
+        struct timespec ts = { 0, ConnectRetryNanos };
+        nanosleep(&ts, NULL);
+    }
+    die("connect() failed");
+    return -1;
+}
+
+static void sendAll(int sock, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            die("send() failed");
+        p += n;
+        len -= n;
+    }
+}
+
+/*
+ * Send one lookup and read its whole answer.
+ * Returns the number of records in it, or -1 if the connection failed.
+ */
+static long lookup(int sock, FILE *fp, int binary, const char *key)
+{
+    size_t keyLen = strlen(key);
+
+    if (binary) {
+        unsigned char req[1 + KeyMax];
+        req[0] = keyLen;
+        memcpy(req + 1, key, keyLen);
+        sendAll(sock, req, 1 + keyLen);
+
+        unsigned char head[1 + KeyMax + 4];
+        int n = fgetc(fp);
+        if (n == EOF || n > KeyMax || fread(head, 1, n + 4, fp) != (size_t)n + 4)
+            return -1;
+        uint32_t count = getBinaryU32(head + n);
+        unsigned char rec[BinaryRecSize];
+        uint32_t i;
+        for (i = 0; i < count; i++) {
+            if (fread(rec, sizeof(rec), 1, fp) != 1)
+                return -1;
+        }
+        return count;
+    }
+
+    char line[1000];
+    snprintf(line, sizeof(line), "%s\n", key);
+    sendAll(sock, line, keyLen + 1);
+
+    // an answer ends with a blank line
+    long count = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strcmp(line, "\n") == 0)
+            return count;
+        count++;
+    }
+    return -1;
+}
+
+static void addLatency(struct BenchConn *conn, int64_t nanos)
+{
+    if (conn->count == conn->cap) {
+        conn->cap = conn->cap ? conn->cap * 2 : 4096;
+        conn->latencies = realloc(conn->latencies, conn->cap * sizeof(int64_t));
+        if (conn->latencies == NULL)
+            die("realloc() failed");
+    }
+    conn->latencies[conn->count++] = nanos;
+}
+
+static void *runConn(void *arg)
+{
+    struct BenchConn *conn = arg;
+    const struct BenchConfig *config = conn->config;
+
+    int sock = connectServer(config);
+    FILE *fp = fdopen(sock, "r");
+    if (fp == NULL)
+        die("fdopen() failed");
+    if (config->binary) {
+        unsigned char hello = BinaryHello;
+        sendAll(sock, &hello, 1);
+        if (fgetc(fp) != BinaryHello) {
+            fprintf(stderr, "the server does not speak the binary protocol\n");
+            exit(1);
+        }
+    }
+
+    sleepUntil(config->start);
+
+    int k = conn->firstKey;
+    int64_t due = config->start + conn->offset;
+    for (;;) {
+        int64_t sent;
+        if (config->interval) {
+            sleepUntil(due);
+            sent = due;
+            due += config->interval;
+        } else {
+            sent = nowNanos();
+        }
+        // a schedule fallen behind is cut off at the end all the same
+        if (sent >= config->end || nowNanos() >= config->end)
+            break;
+
+        long records = lookup(sock, fp, config->binary, config->keys[k]);
+        if (records < 0) {
+            conn->errors++;
+            break;
+        }
+        addLatency(conn, nowNanos() - sent);
+        conn->records += records;
+        if (++k == config->nkeys)
+            k = 0;
+    }
+
+    fclose(fp);
+    return NULL;
+}
+
+static int compareNanos(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// the latency that 'fraction' of the sorted ones are at or below
+static double percentileMicros(const int64_t *sorted, long n, double fraction)
+{
+    long i = (long)(fraction * n + 0.5);
+    if (i > 0)
+        i--;
+    if (i >= n)
+        i = n - 1;
+    return sorted[i] / 1000.0;
+}
+
+static char **readKeys(const char *file, int *nkeys)
+{
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL)
+        die(file);
+
+    char **keys = NULL;
+    int n = 0, cap = 0;
+    char line[1000];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        // the server only looks at the first KeyMax characters
+        line[KeyMax] = '\0';
+        if (n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            if ((keys = realloc(keys, cap * sizeof(char *))) == NULL)
+                die("realloc() failed");
+        }
+        if ((keys[n++] = strdup(line)) == NULL)
+            die("strdup() failed");
+    }
+    fclose(fp);
+
+    if (n == 0) {
+        fprintf(stderr, "%s: no keys\n", file);
+        exit(1);
+    }
+    *nkeys = n;
+    return keys;
+}
+
+int main(int argc, char **argv)
+{
+    struct BenchConfig config;
+    long conns = 4;
+    long seconds = 5;
+    long rate = 0;
+    const char *keyFile = NULL;
+
+    config.binary = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "bc:d:r:k:")) != -1) {
+        switch (opt) {
+            case 'b':
+                config.binary = 1;
+                break;
+            case 'c':
+                if ((conns = parsePositive(optarg, 10000)) < 0)
+                    usage(argv[0]);
+                break;
+            case 'd':
+                if ((seconds = parsePositive(optarg, 86400)) < 0)
+                    usage(argv[0]);
+                break;
+            case 'r':
+                if ((rate = parsePositive(optarg, 100000000)) < 0)
+                    usage(argv[0]);
+                break;
+            case 'k':
+                keyFile = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || keyFile == NULL)
+        usage(argv[0]);
+    config.host = argv[optind];
+    config.port = argv[optind + 1];
+    config.keys = readKeys(keyFile, &config.nkeys);
+
+    // each connection sends every conns/rate seconds, the connections
+    // spread evenly across that interval
+    config.interval = rate ? 1000000000LL * conns / rate : 0;
+    if (rate && config.interval == 0)
+        config.interval = 1;
+
+    struct BenchConn *bench = calloc(conns, sizeof(struct BenchConn));
+    pthread_t *threads = malloc(conns * sizeof(pthread_t));
+    if (bench == NULL || threads == NULL)
+        die("malloc() failed");
+
+    // leave the threads time to connect before the clock starts
+    config.start = nowNanos() + 200000000;
+    config.end = config.start + seconds * 1000000000LL;
+
+    long i;
+    for (i = 0; i < conns; i++) {
+        bench[i].config = &config;
+        bench[i].firstKey = (long long)config.nkeys * i / conns;
+        bench[i].offset = config.interval * i / conns;
+        if (pthread_create(&threads[i], NULL, runConn, &bench[i]) != 0)
+            die("pthread_create() failed");
+    }
+
+    long count = 0, errors = 0, records = 0;
+    for (i = 0; i < conns; i++) {
+        pthread_join(threads[i], NULL);
+        count += bench[i].count;
+        errors += bench[i].errors;
+        records += bench[i].records;
+    }
+
+    int64_t *all = malloc((count ? count : 1) * sizeof(int64_t));
+    if (all == NULL)
+        die("malloc() failed");
+    long n = 0;
+    double sum = 0;
+    for (i = 0; i < conns; i++) {
+        memcpy(all + n, bench[i].latencies, bench[i].count * sizeof(int64_t));
+        n += bench[i].count;
+        free(bench[i].latencies);
+    }
+    qsort(all, n, sizeof(int64_t), compareNanos);
+    for (i = 0; i < n; i++)
+        sum += all[i];
+
+    if (rate)
+        printf("open loop, %ld lookups/s offered", rate);
+    else
+        printf("closed loop");
+    printf(", %ld connections, %ld s, %s protocol\n", conns, seconds,
+            config.binary ? "binary" : "text");
+    printf("lookups:     %ld (%.0f/s), %ld records (%.1f per lookup), "
+            "%ld errors\n", count, (double)count / seconds, records,
+            count ? (double)records / count : 0.0, errors);
+    if (n > 0) {
+        printf("latency us:  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f  "
+                "mean %.1f\n",
+                percentileMicros(all, n, 0.50), percentileMicros(all, n, 0.99),
+                percentileMicros(all, n, 0.999), all[n - 1] / 1000.0,
+                sum / n / 1000.0);
+    }
+
+    free(all);
+    free(bench);
+    free(threads);
+    for (i = 0; i < config.nkeys; i++)
+        free(config.keys[i]);
+    free(config.keys);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * mdb-cache.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mdb-conn.h"
+#include "mdb-cache.h"
+
+// a single response may take up at most this fraction of the budget
+#define MaxEntryFraction 8
+
+// bytes of budget per hash bucket
+#define BytesPerBucket 512
+
+/*
+ * A cached response.  Entries are chained in their hash bucket and in
+ * a doubly linked LRU list, most recently used first.
+ */
+struct Entry {
+    struct Entry *hashNext;
+    struct Entry *lruPrev;
+    struct Entry *lruNext;
+
+    char key[KeyMax + 1];
+    size_t keyLen;
+    int binary;
+
+    size_t len;
+    char data[];
+};
+
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+// all protected by cacheLock
+static struct Entry **buckets;
+static size_t nbuckets;         // a power of two; 0 if disabled
+static struct Entry *lruHead;
+static struct Entry *lruTail;
+static unsigned long generation;
+static struct CacheStats stats;
+
+int initCache(size_t budget)
+{
+    if (budget == 0)
+        return 0;
+
+    size_t n = 64;
+    while (n < budget / BytesPerBucket)
+        n *= 2;
+    buckets = (struct Entry **)calloc(n, sizeof(struct Entry *));
+    if (buckets == NULL)
+        return -1;
+
+    nbuckets = n;
+    stats.budget = budget;
+    return 0;
+}
+
+int cacheEnabled(void)
+{
+    return nbuckets > 0;
+}
+
+size_t cacheMaxEntry(void)
+{
+    return stats.budget / MaxEntryFraction;
+}
+
+static size_t hashKey(const char *key, size_t keyLen, int binary)
+{
+    // FNV-1a
+    size_t h = 2166136261u ^ binary;
+    size_t i;
+    for (i = 0; i < keyLen; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 16777619u;
+    }
+    return h & (nbuckets - 1);
+}
+
+static struct Entry **findSlot(const char *key, size_t keyLen, int binary)
+{
+    struct Entry **slot = &buckets[hashKey(key, keyLen, binary)];
+    while (*slot && ((*slot)->keyLen != keyLen || (*slot)->binary != binary
+                || memcmp((*slot)->key, key, keyLen) != 0))
+        slot = &(*slot)->hashNext;
+    return slot;
+}
+
+static void lruUnlink(struct Entry *e)
+{
+    if (e->lruPrev)
+        e->lruPrev->lruNext = e->lruNext;
+    else
+        lruHead = e->lruNext;
+    if (e->lruNext)
+        e->lruNext->lruPrev = e->lruPrev;
+    else
+        lruTail = e->lruPrev;
+}
+
+static void lruPushFront(struct Entry *e)
+{
+    e->lruPrev = NULL;
+    e->lruNext = lruHead;
+    if (lruHead)
+        lruHead->lruPrev = e;
+    else
+        lruTail = e;
+    lruHead = e;
+}
+
+static void removeEntry(struct Entry *e)
+{
+    *findSlot(e->key, e->keyLen, e->binary) = e->hashNext;
+    lruUnlink(e);
+    stats.entries--;
+    stats.bytes -= e->len;
+    free(e);
+}
+
+int cacheGet(const char *key, size_t keyLen, int binary, unsigned long gen,
+        int (*emit)(void *arg, const char *data, size_t len), void *arg)
+{
+    int ret = 1;
+
+    pthread_mutex_lock(&cacheLock);
+    struct Entry *e = gen == generation
+        ? *findSlot(key, keyLen, binary) : NULL;
+    if (e) {
+        stats.hits++;
+        lruUnlink(e);
+        lruPushFront(e);
+        ret = emit(arg, e->data, e->len);
+    } else {
+        stats.misses++;
+    }
+    pthread_mutex_unlock(&cacheLock);
+    return ret;
+}
+
+int cacheContains(const char *key, size_t keyLen, int binary,
+        unsigned long gen)
+{
+    pthread_mutex_lock(&cacheLock);
+    int found = gen == generation && *findSlot(key, keyLen, binary) != NULL;
+    pthread_mutex_unlock(&cacheLock);
+    return found;
+}
+
+void cacheCountMiss(void)
+{
+    pthread_mutex_lock(&cacheLock);
+    stats.misses++;
+    pthread_mutex_unlock(&cacheLock);
+}
+
+void cachePut(const char *key, size_t keyLen, int binary,
+        unsigned long gen, const char *data, size_t len)
+{
+    if (len > cacheMaxEntry() || keyLen > KeyMax)
+        return;
+
+    struct Entry *e = (struct Entry *)malloc(sizeof(struct Entry) + len);
+    if (e == NULL)
+        return; // it's only a cache
+    memcpy(e->key, key, keyLen);
+    e->key[keyLen] = '\0';
+    e->keyLen = keyLen;
+    e->binary = binary;
+    e->len = len;
+    memcpy(e->data, data, len);
+
+    pthread_mutex_lock(&cacheLock);
+
+    // computed from a snapshot that has been replaced since
+    if (gen != generation) {
+        pthread_mutex_unlock(&cacheLock);
+        free(e);
+        return;
+    }
+
+    struct Entry **slot = findSlot(key, keyLen, binary);
+    if (*slot)
+        removeEntry(*slot); // someone else got there first
+
+    while (stats.bytes + len > stats.budget && lruTail) {
+        removeEntry(lruTail);
+        stats.evictions++;
+    }
+
+    slot = findSlot(key, keyLen, binary);
+    e->hashNext = *slot;
+    *slot = e;
+    lruPushFront(e);
+    stats.entries++;
+    stats.bytes += len;
+    stats.inserts++;
+
+    pthread_mutex_unlock(&cacheLock);
+}
+
+void cacheInvalidate(unsigned long gen)
+{
+    pthread_mutex_lock(&cacheLock);
+    generation = gen;
+    if (lruHead)
+        stats.invalidations++;
+    while (lruHead)
+        removeEntry(lruHead);
+    pthread_mutex_unlock(&cacheLock);
+}
+
+void getCacheStats(struct CacheStats *s)
+{
+    pthread_mutex_lock(&cacheLock);
+    *s = stats;
+    pthread_mutex_unlock(&cacheLock);
+}
@@ -0,0 +1,95 @@
+/*
+ * mdb-cache.h
+ */
+
+#ifndef _MDB_CACHE_H_
+#define _MDB_CACHE_H_
+
+#include <stddef.h>
+
+/*
+ * A cache of complete lookup responses (the formatted record lines
+ * and the terminating blank line, or the binary response), keyed by
+ * the lookup key as returned by makeKey() and the protocol.  It holds
+ * at most a configured number of bytes and evicts the least recently
+ * used responses first.
+ *
+ * Every response belongs to the snapshot generation it was computed
+ * from.  When a new snapshot is published the whole cache is dropped,
+ * and responses computed from an older snapshot are never stored.
+ *
+ * All functions are thread-safe.
+ */
+
+struct CacheStats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long inserts;
+    unsigned long evictions;    // to stay within the budget
+    unsigned long invalidations;
+    size_t entries;
+    size_t bytes;               // response bytes held
+    size_t budget;
+};
+
+/*
+ * Enable the cache with a budget of 'budget' bytes of responses.
+ * A budget of 0 leaves it disabled.
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int initCache(size_t budget);
+
+/*
+ * Returns 1 if the cache is enabled.
+ */
+int cacheEnabled(void);
+
+/*
+ * Responses larger than this are not cached.
+ */
+size_t cacheMaxEntry(void);
+
+/*
+ * Look up the response for 'key' in the text protocol (binary == 0) or
+ * the binary protocol (binary == 1) computed from snapshot generation
+ * 'gen'.  On a hit, emit(arg, data, len) is called with the response
+ * (while the cache is locked, so it must not call back into the cache)
+ * and its return value is returned.  Returns 1 on a miss.
+ */
+int cacheGet(const char *key, size_t keyLen, int binary, unsigned long gen,
+        int (*emit)(void *arg, const char *data, size_t len), void *arg);
+
+/*
+ * Returns 1 if cacheGet() would currently find the response.  Neither
+ * the counters nor the LRU order are touched.
+ */
+int cacheContains(const char *key, size_t keyLen, int binary,
+        unsigned long gen);
+
+/*
+ * Count a miss for a lookup that cacheContains() didn't find, and that
+ * is therefore never passed to cacheGet().
+ */
+void cacheCountMiss(void);
+
+/*
+ * Store a copy of the response for 'key' in the given protocol
+ * computed from snapshot generation 'gen', evicting older responses as
+ * needed.  Does nothing if 'gen' is not the current generation or the
+ * response is too big.
+ */
+void cachePut(const char *key, size_t keyLen, int binary,
+        unsigned long gen, const char *data, size_t len);
+
+/*
+ * Drop every response and only accept ones from generation 'gen' from
+ * now on.
+ */
+void cacheInvalidate(unsigned long gen);
+
+/*
+ * Fill in the current counters.
+ */
+void getCacheStats(struct CacheStats *stats);
+
+#endif /* _MDB_CACHE_H_ */
@@ -0,0 +1,514 @@
+/*
+ * mdb-conn.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "mdb.h"
+#include "mdb-snapshot.h"
+#include "mdb-cache.h"
+#include "mdb-proto.h"
+#include "mdb-conn.h"
+
+// longest line MDB_REC_FMT can produce, including the NUL
+#define RecLineMax 64
+
+// longest header of a binary response
+#define BinaryHeaderMax (1 + KeyMax + 4)
+
+// chunks handed to one sendmsg() call
+#define MaxIov 64
+
+size_t makeKey(const char *line, size_t len, char *key)
+{
+    size_t n = 0;
+    while (n < KeyMax && n < len && line[n] != '\0') {
+        key[n] = line[n];
+        n++;
+    }
+
+    // if newline is there, remove it.
+    if (n > 0 && key[n - 1] == '\n')
+        n--;
+    key[n] = '\0';
+    return n;
+}
+
+size_t makeBinaryKey(const char *data, size_t len, char *key)
+{
+    size_t n = 0;
+    while (n < KeyMax && n < len && data[n] != '\0') {
+        key[n] = data[n];
+        n++;
+    }
+    key[n] = '\0';
+    return n;
+}
+
+struct Conn *newConn(int sock, const struct sockaddr_in *addr)
+{
+    struct Conn *conn = (struct Conn *)malloc(sizeof(struct Conn));
+    if (conn == NULL)
+        return NULL;
+
+    conn->sock = sock;
+    conn->addr = *addr;
+    conn->inLen = 0;
+    conn->eof = 0;
+    conn->greeted = 0;
+    conn->binary = 0;
+    conn->outHead = NULL;
+    conn->outTail = NULL;
+    conn->outPending = 0;
+    conn->spare = NULL;
+    conn->snap = NULL;
+    conn->batchLen = 0;
+    conn->current = 0;
+    conn->responding = 0;
+    conn->nextHit = 0;
+    conn->capture = NULL;
+    conn->captureLen = 0;
+    conn->captureCap = 0;
+    return conn;
+}
+
+static void stopCapture(struct Conn *conn)
+{
+    free(conn->capture);
+    conn->capture = NULL;
+    conn->captureLen = 0;
+    conn->captureCap = 0;
+}
+
+static void endBatch(struct Conn *conn)
+{
+    int i;
+
+    stopCapture(conn);
+    for (i = 0; i < conn->batchLen; i++)
+        freeHits(&conn->batch[i].hits);
+    conn->batchLen = 0;
+    conn->current = 0;
+    conn->responding = 0;
+    conn->nextHit = 0;
+    releaseSnapshot(conn->snap);
+    conn->snap = NULL;
+}
+
+void freeConn(struct Conn *conn)
+{
+    close(conn->sock);
+
+    if (conn->snap)
+        endBatch(conn);
+
+    struct OutChunk *c = conn->outHead;
+    while (c) {
+        struct OutChunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    free(conn->spare);
+    free(conn);
+}
+
+ssize_t readConn(struct Conn *conn)
+{
+    ssize_t n;
+    do {
+        n = recv(conn->sock, conn->in + conn->inLen,
+                sizeof(conn->in) - conn->inLen, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0)
+        conn->inLen += n;
+    else if (n == 0)
+        conn->eof = 1;
+    return n;
+}
+
+/*
+ * Length of the request line at the start of 'in', or 0 if there is
+ * no complete one.  Lines are split exactly where fgets() with a
+ * (LineMax + 1)-byte buffer would split them.
+ */
+static size_t lineLength(const char *in, size_t inLen, int eof)
+{
+    size_t scan = inLen < LineMax ? inLen : LineMax;
+    const char *nl = memchr(in, '\n', scan);
+    if (nl)
+        return nl - in + 1;
+    if (inLen >= LineMax)
+        return LineMax;
+    return eof ? inLen : 0;
+}
+
+/*
+ * Length of the request at 'pos' in the input, or 0 if there is no
+ * complete one.
+ */
+static size_t requestLength(const struct Conn *conn, size_t pos)
+{
+    const char *in = conn->in + pos;
+    size_t inLen = conn->inLen - pos;
+
+    if (!conn->binary)
+        return lineLength(in, inLen, conn->eof);
+
+    // a partial request left at end of file is dropped
+    if (inLen == 0 || inLen < 1 + (size_t)(unsigned char)in[0])
+        return 0;
+    return 1 + (unsigned char)in[0];
+}
+
+int connHasWork(const struct Conn *conn)
+{
+    return conn->snap != NULL
+        || (!conn->greeted && conn->inLen > 0)
+        || requestLength(conn, 0) > 0;
+}
+
+/*
+ * Return room for at least 'len' more bytes at the end of the output
+ * queue, or NULL if memory could not be allocated.
+ */
+static char *reserveOut(struct Conn *conn, size_t len)
+{
+    struct OutChunk *tail = conn->outTail;
+    if (tail && tail->len + len <= OutChunkSize)
+        return tail->data + tail->len;
+
+    struct OutChunk *c = conn->spare;
+    if (c)
+        conn->spare = NULL;
+    else if ((c = (struct OutChunk *)malloc(sizeof(struct OutChunk))) == NULL)
+        return NULL;
+
+    c->next = NULL;
+    c->len = 0;
+    c->sent = 0;
+    if (tail)
+        tail->next = c;
+    else
+        conn->outHead = c;
+    conn->outTail = c;
+    return c->data;
+}
+
+static void startCapture(struct Conn *conn)
+{
+    conn->captureLen = 0;
+    conn->captureCap = 4096;
+    if ((conn->capture = (char *)malloc(conn->captureCap)) == NULL)
+        conn->captureCap = 0;
+}
+
+/*
+ * Keep a copy of 'len' bytes of response for the cache, giving up once
+ * the response is too big to be cached.
+ */
+static void capture(struct Conn *conn, const char *data, size_t len)
+{
+    if (conn->capture == NULL)
+        return;
+
+    if (conn->captureLen + len > conn->captureCap) {
+        size_t cap = conn->captureCap * 2;
+        while (cap < conn->captureLen + len)
+            cap *= 2;
+        char *p;
+        if (cap > cacheMaxEntry()
+                || (p = (char *)realloc(conn->capture, cap)) == NULL) {
+            stopCapture(conn);
+            return;
+        }
+        conn->capture = p;
+        conn->captureCap = cap;
+    }
+    memcpy(conn->capture + conn->captureLen, data, len);
+    conn->captureLen += len;
+}
+
+static void commitOut(struct Conn *conn, size_t len)
+{
+    capture(conn, conn->outTail->data + conn->outTail->len, len);
+    conn->outTail->len += len;
+    conn->outPending += len;
+}
+
+/*
+ * Append 'len' bytes to the output; used for cached responses.
+ */
+static int appendOut(void *arg, const char *data, size_t len)
+{
+    struct Conn *conn = (struct Conn *)arg;
+    while (len > 0) {
+        char *p = reserveOut(conn, 1);
+        if (p == NULL)
+            return -1;
+        size_t room = OutChunkSize - conn->outTail->len;
+        size_t n = len < room ? len : room;
+        memcpy(p, data, n);
+        conn->outTail->len += n;
+        conn->outPending += n;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Format one matching record: a line of text, or the record number
+ * and the raw record in the binary protocol.
+ */
+static int formatHit(struct Conn *conn, int i)
+{
+    const struct MdbRec *rec = &conn->snap->db.recs[i];
+    int recNo = conn->snap->db.first + i + 1;
+
+    if (conn->binary) {
+        unsigned char *p = (unsigned char *)reserveOut(conn, BinaryRecSize);
+        if (p == NULL)
+            return -1;
+        putBinaryU32(p, recNo);
+        memcpy(p + 4, rec->name, sizeof(rec->name));
+        memcpy(p + 4 + sizeof(rec->name), rec->msg, sizeof(rec->msg));
+        commitOut(conn, BinaryRecSize);
+        return 0;
+    }
+
+    char *p = reserveOut(conn, RecLineMax);
+    if (p == NULL)
+        return -1;
+    commitOut(conn, snprintf(p, RecLineMax, MDB_REC_FMT,
+                MDB_REC_ARGS(recNo, rec)));
+    return 0;
+}
+
+/*
+ * Start a binary response: the key and the number of records.
+ */
+static int formatBinaryHeader(struct Conn *conn, const struct ConnQuery *q)
+{
+    unsigned char *p = (unsigned char *)reserveOut(conn, BinaryHeaderMax);
+    if (p == NULL)
+        return -1;
+    p[0] = q->keyLen;
+    memcpy(p + 1, q->key, q->keyLen);
+    putBinaryU32(p + 1 + q->keyLen, q->hits.count);
+    commitOut(conn, 1 + q->keyLen + 4);
+    return 0;
+}
+
+/*
+ * Format the responses of the current batch in order, as long as the
+ * output stays below the high-water mark: for each query, one line
+ * per matching record followed by a blank line (or a binary response).
+ * The batch is ended once all of them are out.
+ */
+static int streamBatch(struct Conn *conn)
+{
+    while (conn->current < conn->batchLen) {
+        struct ConnQuery *q = &conn->batch[conn->current];
+
+        if (conn->outPending >= OutHighWater)
+            return 0;
+
+        if (q->cached) {
+            int ret = cacheGet(q->key, q->keyLen, conn->binary,
+                    conn->snap->gen, &appendOut, conn);
+            if (ret < 0)
+                return -1;
+            if (ret == 0) {
+                conn->current++;
+                continue;
+            }
+
+            // evicted since the batch was looked up
+            q->cached = 0;
+            if (lookupSnapshot(conn->snap, q->key, q->keyLen, &q->hits) < 0)
+                return -1;
+        }
+
+        if (!conn->responding) {
+            conn->responding = 1;
+            if (cacheEnabled())
+                startCapture(conn);
+            if (conn->binary && formatBinaryHeader(conn, q) < 0)
+                return -1;
+        }
+
+        while (conn->nextHit < q->hits.count) {
+            if (conn->outPending >= OutHighWater)
+                return 0;
+            if (formatHit(conn, q->hits.recs[conn->nextHit++]) < 0)
+                return -1;
+        }
+
+        // a blank line indicates the end of search result
+        if (!conn->binary) {
+            char *p = reserveOut(conn, 1);
+            if (p == NULL)
+                return -1;
+            *p = '\n';
+            commitOut(conn, 1);
+        }
+
+        if (conn->capture)
+            cachePut(q->key, q->keyLen, conn->binary, conn->snap->gen,
+                    conn->capture, conn->captureLen);
+        stopCapture(conn);
+        freeHits(&q->hits);
+        conn->responding = 0;
+        conn->nextHit = 0;
+        conn->current++;
+    }
+
+    endBatch(conn);
+    return 0;
+}
+
+/*
+ * Look up the keys of conn->batch and start streaming the responses.
+ */
+static int startBatch(struct Conn *conn)
+{
+    const char *keys[BatchMax];
+    size_t keyLens[BatchMax];
+    struct MdbHits found[BatchMax];
+    int which[BatchMax];
+    int n = 0;
+    int i;
+
+    // run the queries against the current snapshot, which stays valid
+    // until we release it even if a reload swaps it out; we hold on to
+    // it until the last result is formatted
+    conn->snap = acquireSnapshot();
+    conn->current = 0;
+    conn->nextHit = 0;
+
+    // look up together whatever the cache can't answer; the hits are
+    // counted by cacheGet() as they are streamed
+    for (i = 0; i < conn->batchLen; i++) {
+        struct ConnQuery *q = &conn->batch[i];
+        q->cached = cacheEnabled()
+            && cacheContains(q->key, q->keyLen, conn->binary,
+                    conn->snap->gen);
+        if (!q->cached) {
+            if (cacheEnabled())
+                cacheCountMiss();
+            keys[n] = q->key;
+            keyLens[n] = q->keyLen;
+            initHits(&found[n]);
+            which[n++] = i;
+        }
+    }
+
+    int err = 0;
+    if (n > 0)
+        err = lookupSnapshotBatch(conn->snap, n, keys, keyLens, found);
+    for (i = 0; i < n; i++)
+        conn->batch[which[i]].hits = found[i];
+    if (err < 0) {
+        endBatch(conn);
+        return -1;
+    }
+    return streamBatch(conn);
+}
+
+int processConn(struct Conn *conn)
+{
+    size_t pos = 0;
+    size_t len;
+    int err = 0;
+
+    // the first byte of a connection chooses the protocol
+    if (!conn->greeted && conn->inLen > 0) {
+        conn->greeted = 1;
+        if ((unsigned char)conn->in[0] == BinaryHello) {
+            const char hello = (char)BinaryHello;
+            conn->binary = 1;
+            pos = 1;
+            err = appendOut(conn, &hello, 1);
+        }
+    }
+
+    if (err == 0 && conn->snap)
+        err = streamBatch(conn);
+
+    while (err == 0 && conn->snap == NULL
+            && conn->outPending < OutHighWater
+            && requestLength(conn, pos) > 0) {
+        // every request that is waiting goes into the batch
+        while (conn->batchLen < BatchMax
+                && (len = requestLength(conn, pos)) > 0) {
+            struct ConnQuery *q = &conn->batch[conn->batchLen++];
+            if (conn->binary)
+                q->keyLen = makeBinaryKey(conn->in + pos + 1, len - 1, q->key);
+            else
+                q->keyLen = makeKey(conn->in + pos, len, q->key);
+            initHits(&q->hits);
+            pos += len;
+        }
+
+        err = startBatch(conn);
+    }
+
+    memmove(conn->in, conn->in + pos, conn->inLen - pos);
+    conn->inLen -= pos;
+    return err;
+}
+
+int flushConn(struct Conn *conn)
+{
+    while (conn->outPending > 0) {
+        // hand the kernel as much of the queue as we can at once
+        struct iovec iov[MaxIov];
+        struct msghdr msg;
+        int n = 0;
+        struct OutChunk *c;
+        for (c = conn->outHead; c && n < MaxIov; c = c->next, n++) {
+            iov[n].iov_base = c->data + c->sent;
+            iov[n].iov_len = c->len - c->sent;
+        }
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+
+        ssize_t sent = sendmsg(conn->sock, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        conn->outPending -= sent;
+
+        // drop the chunks that are completely written
+        while (sent > 0) {
+            c = conn->outHead;
+            size_t left = c->len - c->sent;
+            if ((size_t)sent < left) {
+                c->sent += sent;
+                break;
+            }
+            sent -= left;
+            conn->outHead = c->next;
+            if (conn->outHead == NULL)
+                conn->outTail = NULL;
+            if (conn->spare == NULL)
+                conn->spare = c;
+            else
+                free(c);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * mdb-conn.h
+ */
+
+#ifndef _MDB_CONN_H_
+#define _MDB_CONN_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "mdb.h"
+
+// keys longer than this are truncated
+#define KeyMax 5
+
+// a request line longer than this is split, just like fgets() would
+#define LineMax 999
+
+// stop formatting results for a client whose unsent output exceeds
+// this; a large result set is streamed out in pieces of about this size
+#define OutHighWater (256 * 1024)
+
+// output is queued in blocks of this size
+#define OutChunkSize (16 * 1024)
+
+// at most this many request lines are looked up together
+#define BatchMax 128
+
+/*
+ * Turn a request line of 'len' bytes into a lookup key: its first
+ * KeyMax characters (up to a NUL), without the trailing newline.
+ * 'key' must have room for KeyMax + 1 bytes.  Returns the key length.
+ */
+size_t makeKey(const char *line, size_t len, char *key);
+
+/*
+ * Same as makeKey() for the key of a binary request, which has no
+ * newline to remove.
+ */
+size_t makeBinaryKey(const char *data, size_t len, char *key);
+
+/*
+ * A block of queued output.
+ */
+struct OutChunk {
+    struct OutChunk *next;
+    size_t len;         // bytes filled in
+    size_t sent;        // of which already written
+    char data[OutChunkSize];
+};
+
+/*
+ * A request line of the batch being answered.
+ */
+struct ConnQuery {
+    char key[KeyMax + 1];
+    size_t keyLen;
+    int cached;         // to be answered from the response cache
+    struct MdbHits hits;
+};
+
+/*
+ * The state of one client connection.
+ *
+ * Requests are newline-delimited keys, or length-prefixed keys if the
+ * client opened with the binary protocol handshake (see mdb-proto.h).
+ * Bytes are read into 'in' as they arrive and every complete request
+ * is answered in order.  Clients may send many requests without
+ * waiting for the answers; all the requests that are waiting (up to
+ * BatchMax) are looked up together in one pass over the records, and
+ * answered one after the other.
+ *
+ * Responses are formatted into a queue of chunks which is written out
+ * with as few sendmsg() calls as the socket allows, each taking many
+ * chunks at once.  The socket may be blocking or non-blocking.
+ *
+ * Responses come from the response cache when possible, and are
+ * copied into it as they are formatted otherwise.
+ *
+ * Formatting stops whenever the unsent output reaches OutHighWater and
+ * resumes once it has been written, so a query matching millions of
+ * records is streamed without buffering all of its output.
+ */
+struct Conn {
+    int sock;
+    struct sockaddr_in addr;
+
+    char in[4 * (LineMax + 1)];
+    size_t inLen;
+    int eof;            // the client shut down its side
+    int greeted;        // the protocol has been chosen
+    int binary;         // speaking the binary protocol
+
+    struct OutChunk *outHead;
+    struct OutChunk *outTail;
+    size_t outPending;  // unsent bytes in the queue
+    struct OutChunk *spare; // an empty chunk kept for reuse
+
+    // the batch being answered, while its output is being streamed;
+    // the queries before 'current' are done
+    struct MdbSnapshot *snap;   // NULL if none
+    struct ConnQuery batch[BatchMax];
+    int batchLen;
+    int current;
+    int responding;     // the current response has been started
+    int nextHit;
+
+    // a copy of the response so far, for the cache; NULL when the
+    // cache is off or the response got too big for it
+    char *capture;
+    size_t captureLen;
+    size_t captureCap;
+};
+
+/*
+ * Allocate the state for a connected socket.
+ * Returns NULL if memory could not be allocated.
+ */
+struct Conn *newConn(int sock, const struct sockaddr_in *addr);
+
+/*
+ * Close the socket and free the connection.
+ */
+void freeConn(struct Conn *conn);
+
+/*
+ * Read what is available from the socket.  Returns the number of bytes
+ * read, 0 at end of file (and sets conn->eof), or -1 on error, with
+ * errno set to EAGAIN if there was nothing to read.
+ */
+ssize_t readConn(struct Conn *conn);
+
+/*
+ * Answer the complete requests received so far (and, once a text
+ * client has shut down, the final partial line), stopping early if the
+ * unsent output reaches OutHighWater.
+ *
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int processConn(struct Conn *conn);
+
+/*
+ * Write as much pending output as the socket accepts.
+ * Returns 0 on success (including a full socket buffer) and -1 if the
+ * connection failed.
+ */
+int flushConn(struct Conn *conn);
+
+/*
+ * Returns 1 if processConn() has something to do: a request is ready,
+ * or a batch is only partly answered.
+ */
+int connHasWork(const struct Conn *conn);
+
+/*
+ * Returns 1 if there is output waiting to be written.
+ */
+static inline int connHasOutput(const struct Conn *conn)
+{
+    return conn->outPending > 0;
+}
+
+/*
+ * Returns 1 if the connection should be polled for input: the client
+ * has not shut down, there is room in the input buffer and the output
+ * is below the high-water mark.
+ */
+static inline int connWantsInput(const struct Conn *conn)
+{
+    return !conn->eof && conn->inLen < sizeof(conn->in)
+        && conn->outPending < OutHighWater;
+}
+
+/*
+ * Returns 1 once everything the client sent has been answered and the
+ * answers written out.
+ */
+static inline int connDone(const struct Conn *conn)
+{
+    return conn->eof && !connHasWork(conn) && !connHasOutput(conn);
+}
+
+#endif /* _MDB_CONN_H_ */
@@ -0,0 +1,286 @@
+/*
+ * mdb-gen.c
+ *
+ * Generate a synthetic database for benchmarking mdb-lookup-server,
+ * and optionally a file of keys to look up in it with mdb-bench.
+ *
+ * Names and messages are made of words from a made-up vocabulary.
+ * Words are drawn with a Zipf distribution of skew -z (0 for uniform),
+ * so that some keys match many records and most match few, as with
+ * real names and messages.  The same seed gives the same database.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "mdb.h"
+#include "mdb-conn.h"
+
+// longest word of the vocabulary, so that a name holds at least one
+#define WordMax 12
+
+static void die(const char *s) { perror(s); exit(1); }
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n records] [-w words] [-z skew] [-s seed] "
+            "[-K key-file] [-k keys] [-l min-key-len] [-x miss-percent] "
+            "<db_file>\n", prog);
+    fprintf(stderr, "  -n  number of records (default: 100000)\n");
+    fprintf(stderr, "  -w  size of the vocabulary names and messages "
+            "are made of (default: 20000)\n");
+    fprintf(stderr, "  -z  skew of the Zipf distribution words are drawn "
+            "with; 0 is uniform (default: 0.8)\n");
+    fprintf(stderr, "  -s  seed of the random numbers (default: 1)\n");
+    fprintf(stderr, "  -K  also write keys to look up, one per line, "
+            "to this file\n");
+    fprintf(stderr, "  -k  number of keys for -K (default: 10000)\n");
+    fprintf(stderr, "  -l  shortest key for -K; shorter keys match more "
+            "records (default: 3)\n");
+    fprintf(stderr, "  -x  percentage of the keys that are random letters, "
+            "mostly matching nothing (default: 10)\n");
+    exit(1);
+}
+
+/*
+ * Parse a decimal number between 0 and 'max'.
+ * Returns -1 if 'arg' is not one.
+ */
+static long parseCount(const char *arg, long max)
+{
+    char *end;
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (errno || end == arg || *end != '\0' || n < 0 || n > max)
+        return -1;
+    return n;
+}
+
+/*
+ * xorshift64*: fast, and the same sequence everywhere for a seed.
+ */
+static uint64_t rngState;
+
+static uint64_t nextRandom(void)
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545F4914F6CDD1DULL;
+}
+
+// uniform in [0, n)
+static int randomBelow(int n)
+{
+    return (int)((nextRandom() >> 11) % (uint64_t)n);
+}
+
+// uniform in [0, 1)
+static double randomUnit(void)
+{
+    return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+struct Vocabulary {
+    char (*words)[WordMax + 1];
+    double *cdf;        // cdf[i]: probability of drawing a word <= i
+    int count;
+};
+
+/*
+ * Make up 'count' distinct-looking words out of syllables, and the
+ * distribution they are drawn with.
+ */
+static void initVocabulary(struct Vocabulary *voc, int count, double skew)
+{
+    static const char consonants[] = "bcdfghjklmnprstvwz";
+    static const char vowels[] = "aeiou";
+
+    voc->words = malloc(count * sizeof(*voc->words));
+    voc->cdf = malloc(count * sizeof(double));
+    if (voc->words == NULL || voc->cdf == NULL)
+        die("malloc() failed");
+    voc->count = count;
+
+    int i;
+    double total = 0;
+    for (i = 0; i < count; i++) {
+        char *w = voc->words[i];
+        int len = 0;
+        int syllables = 1 + randomBelow(WordMax / 3);
+        while (syllables-- > 0) {
+            w[len++] = consonants[randomBelow(sizeof(consonants) - 1)];
+            w[len++] = vowels[randomBelow(sizeof(vowels) - 1)];
+            if (randomBelow(3) == 0)
+                w[len++] = consonants[randomBelow(sizeof(consonants) - 1)];
+        }
+        w[len] = '\0';
+
+        total += 1.0 / pow(i + 1, skew);
+        voc->cdf[i] = total;
+    }
+    for (i = 0; i < count; i++)
+        voc->cdf[i] /= total;
+}
+
+static const char *drawWord(const struct Vocabulary *voc)
+{
+    double u = randomUnit();
+    int lo = 0, hi = voc->count - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (voc->cdf[mid] <= u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return voc->words[lo];
+}
+
+/*
+ * Fill the 'cap'-byte field 'f' with words separated by spaces, at
+ * least one and as many as fit, leaving room for the NUL.
+ */
+static void fillField(char *f, size_t cap, const struct Vocabulary *voc)
+{
+    size_t len = 0;
+    for (;;) {
+        const char *w = drawWord(voc);
+        size_t wlen = strlen(w);
+        if (len > 0 && len + 1 + wlen >= cap)
+            break;
+        if (len > 0)
+            f[len++] = ' ';
+        if (wlen >= cap - len)
+            wlen = cap - len - 1;
+        memcpy(f + len, w, wlen);
+        len += wlen;
+        // stop at a random length rather than always filling up
+        if (randomBelow(3) == 0)
+            break;
+    }
+}
+
+static void writeKeys(const char *file, int count, int minLen,
+        int missPercent, const struct Vocabulary *voc)
+{
+    FILE *fp = fopen(file, "w");
+    if (fp == NULL)
+        die(file);
+
+    int i;
+    for (i = 0; i < count; i++) {
+        char key[KeyMax + 1];
+        int len = minLen + randomBelow(KeyMax - minLen + 1);
+        if (randomBelow(100) < missPercent) {
+            int j;
+            for (j = 0; j < len; j++)
+                key[j] = 'a' + randomBelow(26);
+            key[len] = '\0';
+        } else {
+            // a piece of a word, the way a user would type part of a name
+            const char *w = drawWord(voc);
+            int wlen = strlen(w);
+            if (len > wlen)
+                len = wlen;
+            int from = randomBelow(wlen - len + 1);
+            memcpy(key, w + from, len);
+            key[len] = '\0';
+        }
+        fprintf(fp, "%s\n", key);
+    }
+    if (fclose(fp) != 0)
+        die(file);
+}
+
+int main(int argc, char **argv)
+{
+    long records = 100000;
+    long words = 20000;
+    double skew = 0.8;
+    long seed = 1;
+    const char *keyFile = NULL;
+    long keys = 10000;
+    long minKeyLen = 3;
+    long missPercent = 10;
+
+    int opt;
+    char *end;
+    while ((opt = getopt(argc, argv, "n:w:z:s:K:k:l:x:")) != -1) {
+        switch (opt) {
+            case 'n':
+                if ((records = parseCount(optarg, INT_MAX)) < 0)
+                    usage(argv[0]);
+                break;
+            case 'w':
+                if ((words = parseCount(optarg, 10000000)) < 1)
+                    usage(argv[0]);
+                break;
+            case 'z':
+                skew = strtod(optarg, &end);
+                if (end == optarg || *end != '\0' || skew < 0)
+                    usage(argv[0]);
+                break;
+            case 's':
+                if ((seed = parseCount(optarg, LONG_MAX)) < 0)
+                    usage(argv[0]);
+                break;
+            case 'K':
+                keyFile = optarg;
+                break;
+            case 'k':
+                if ((keys = parseCount(optarg, INT_MAX)) < 0)
+                    usage(argv[0]);
+                break;
+            case 'l':
+                if ((minKeyLen = parseCount(optarg, KeyMax)) < 1)
+                    usage(argv[0]);
+                break;
+            case 'x':
+                if ((missPercent = parseCount(optarg, 100)) < 0)
+                    usage(argv[0]);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind != 1)
+        usage(argv[0]);
+    const char *filename = argv[optind];
+
+    // xorshift gets stuck at 0
+    rngState = 0x9E3779B97F4A7C15ULL ^ (uint64_t)seed;
+    nextRandom();
+
+    struct Vocabulary voc;
+    initVocabulary(&voc, words, skew);
+
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL)
+        die(filename);
+
+    long i;
+    for (i = 0; i < records; i++) {
+        struct MdbRec rec;
+        memset(&rec, 0, sizeof(rec));
+        fillField(rec.name, sizeof(rec.name), &voc);
+        fillField(rec.msg, sizeof(rec.msg), &voc);
+        if (fwrite(&rec, sizeof(rec), 1, fp) != 1)
+            die(filename);
+    }
+    if (fclose(fp) != 0)
+        die(filename);
+
+    if (keyFile)
+        writeKeys(keyFile, keys, minKeyLen, missPercent, &voc);
+
+    free(voc.words);
+    free(voc.cdf);
+    return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * mdb-index.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdb.h"
+#include "mdb-index.h"
+
+/*
+ * Number of 3-gram buckets per record, rounded up to a power of two.
+ * Records have at most 36 distinct 3-grams, but most share them.
+ */
+#define TrigramBucketsPerRec 4
+#define TrigramMinBits 10
+#define TrigramMaxBits 22
+
+static inline uint32_t gramBucket(const struct MdbGramTable *t,
+        const unsigned char *s)
+{
+    switch (t->q) {
+    case 1:
+        return s[0];
+    case 2:
+        return (uint32_t)s[0] << 8 | s[1];
+    default:
+        // Fibonacci hashing; the top bits are the best mixed
+        return ((uint32_t)s[0] << 16 | (uint32_t)s[1] << 8 | s[2])
+            * 2654435761u >> (32 - t->bits);
+    }
+}
+
+/*
+ * Store in 'out' the distinct buckets that the q-grams of record 'rec'
+ * fall into, and return how many there are (at most the record size).
+ * 'last' holds, per bucket, the last record seen, which is how
+ * duplicates are skipped without sorting.
+ */
+static int recBuckets(const struct MdbGramTable *t, const struct MdbStore *db,
+        uint32_t rec, uint32_t *last, uint32_t *out)
+{
+    const struct MdbRec *r = &db->recs[rec];
+    const char *fields[2] = { r->name, r->msg };
+    size_t caps[2] = { sizeof(r->name), sizeof(r->msg) };
+    int f, n = 0;
+
+    for (f = 0; f < 2; f++) {
+        size_t len = strnlen(fields[f], caps[f]);
+        size_t p;
+        for (p = 0; p + t->q <= len; p++) {
+            uint32_t bucket = gramBucket(t,
+                    (const unsigned char *)fields[f] + p);
+            if (last[bucket] != rec) {
+                last[bucket] = rec;
+                out[n++] = bucket;
+            }
+        }
+    }
+    return n;
+}
+
+static int buildGramTable(const struct MdbStore *db, struct MdbGramTable *t)
+{
+    size_t nbuckets = (size_t)1 << t->bits;
+    uint32_t buckets[sizeof(struct MdbRec)];
+    int i, j, n;
+
+    t->offsets = (size_t *)calloc(nbuckets + 1, sizeof(size_t));
+    uint32_t *last = (uint32_t *)malloc(nbuckets * sizeof(uint32_t));
+    if (t->offsets == NULL || last == NULL)
+        goto fail;
+
+    // first pass: count the postings in each bucket
+    memset(last, 0xff, nbuckets * sizeof(uint32_t));
+    for (i = 0; i < db->count; i++) {
+        n = recBuckets(t, db, i, last, buckets);
+        for (j = 0; j < n; j++)
+            t->offsets[buckets[j] + 1]++;
+    }
+
+    size_t b;
+    for (b = 0; b < nbuckets; b++)
+        t->offsets[b + 1] += t->offsets[b];
+
+    t->postings = (uint32_t *)malloc(
+            (t->offsets[nbuckets] ? t->offsets[nbuckets] : 1) * sizeof(uint32_t));
+    size_t *fill = (size_t *)malloc(nbuckets * sizeof(size_t));
+    if (t->postings == NULL || fill == NULL) {
+        free(fill);
+        goto fail;
+    }
+
+    // second pass: fill them in; records are visited in order, so each
+    // posting list comes out sorted
+    memcpy(fill, t->offsets, nbuckets * sizeof(size_t));
+    memset(last, 0xff, nbuckets * sizeof(uint32_t));
+    for (i = 0; i < db->count; i++) {
+        n = recBuckets(t, db, i, last, buckets);
+        for (j = 0; j < n; j++)
+            t->postings[fill[buckets[j]]++] = i;
+    }
+
+    free(fill);
+    free(last);
+    return 0;
+
+fail:
+    free(last);
+    free(t->offsets);
+    t->offsets = NULL;
+    return -1;
+}
+
+int buildIndex(const struct MdbStore *db, struct MdbIndex *idx)
+{
+    memset(idx, 0, sizeof(*idx));
+
+    int bits = TrigramMinBits;
+    while (bits < TrigramMaxBits
+            && ((size_t)1 << bits) < (size_t)db->count * TrigramBucketsPerRec)
+        bits++;
+
+    idx->grams[0].q = 1;
+    idx->grams[0].bits = 8;
+    idx->grams[1].q = 2;
+    idx->grams[1].bits = 16;
+    idx->grams[2].q = 3;
+    idx->grams[2].bits = bits;
+
+    int q;
+    for (q = 0; q < 3; q++) {
+        if (buildGramTable(db, &idx->grams[q]) < 0) {
+            freeIndex(idx);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void freeIndex(struct MdbIndex *idx)
+{
+    int q;
+    for (q = 0; q < 3; q++) {
+        free(idx->grams[q].offsets);
+        free(idx->grams[q].postings);
+    }
+    memset(idx, 0, sizeof(*idx));
+}
+
+struct Posting {
+    const uint32_t *p;
+    const uint32_t *end;
+};
+
+static void getPosting(const struct MdbGramTable *t, const char *gram,
+        struct Posting *list)
+{
+    uint32_t bucket = gramBucket(t, (const unsigned char *)gram);
+    list->p = t->postings + t->offsets[bucket];
+    list->end = t->postings + t->offsets[bucket + 1];
+}
+
+int lookupIndex(const struct MdbIndex *idx, const struct MdbStore *db,
+        const char *key, size_t keyLen, struct MdbHits *hits)
+{
+    int i;
+
+    // everything matches the empty key
+    if (keyLen == 0) {
+        for (i = 0; i < db->count; i++)
+            if (addHit(hits, i) < 0)
+                return -1;
+        return 0;
+    }
+
+    // 1- and 2-gram lists are exact; no need to look at the records
+    if (keyLen <= 2) {
+        struct Posting list;
+        getPosting(&idx->grams[keyLen - 1], key, &list);
+        for (; list.p < list.end; list.p++)
+            if (addHit(hits, *list.p) < 0)
+                return -1;
+        return 0;
+    }
+
+    // intersect the lists of all the key's 3-grams, driven by the
+    // shortest one
+    size_t n = keyLen - 2;
+    struct Posting lists[n];
+    size_t j, shortest = 0;
+    for (j = 0; j < n; j++) {
+        getPosting(&idx->grams[2], key + j, &lists[j]);
+        if (lists[j].end - lists[j].p < lists[shortest].end - lists[shortest].p)
+            shortest = j;
+    }
+
+    const uint32_t *c;
+    for (c = lists[shortest].p; c < lists[shortest].end; c++) {
+        int inAll = 1;
+        for (j = 0; j < n && inAll; j++) {
+            struct Posting *l = &lists[j];
+            while (l->p < l->end && *l->p < *c)
+                l->p++;
+            inAll = l->p < l->end && *l->p == *c;
+        }
+        if (!inAll)
+            continue;
+
+        // all the 3-grams are somewhere in the record, and the buckets
+        // are hashed; check for the real thing
+        if (mdbRecMatches(&db->recs[*c], key, keyLen) && addHit(hits, *c) < 0)
+            return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * mdb-index.h
+ */
+
+#ifndef _MDB_INDEX_H_
+#define _MDB_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mdb.h"
+
+/*
+ * Posting lists for all the q-grams of one length.  The records that
+ * contain a q-gram hashing to bucket 'b' (in their name or their msg)
+ * are postings[offsets[b]] through postings[offsets[b + 1] - 1], in
+ * ascending order and without duplicates.
+ */
+struct MdbGramTable {
+    int q;              // q-gram length
+    int bits;           // log2 of the number of buckets
+    size_t *offsets;    // (1 << bits) + 1 entries
+    uint32_t *postings;
+};
+
+/*
+ * An inverted index over the names and msgs of a database.
+ *
+ * Keys are at most a few characters long, so we index every 1-, 2- and
+ * 3-gram.  The 1- and 2-gram tables have a bucket for every possible
+ * gram, so their posting lists are exact answers for 1- and 2-char
+ * keys.  The 3-gram table is hashed; a longer key is answered by
+ * intersecting the lists of all its 3-grams and checking the surviving
+ * candidates against the records.
+ */
+struct MdbIndex {
+    struct MdbGramTable grams[3];
+};
+
+/*
+ * Build the index for 'db'.
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int buildIndex(const struct MdbStore *db, struct MdbIndex *idx);
+
+/*
+ * Free the memory held by the index.
+ */
+void freeIndex(struct MdbIndex *idx);
+
+/*
+ * Find the records of 'db' matching 'key' using 'idx', which must
+ * have been built from 'db', and append them to 'hits'.  The result is
+ * the same as that of scanmdb().
+ *
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int lookupIndex(const struct MdbIndex *idx, const struct MdbStore *db,
+        const char *key, size_t keyLen, struct MdbHits *hits);
+
+#endif /* _MDB_INDEX_H_ */
@@ -5,52 +5,331 @@
 #include <stdio.h>
 #include <stdlib.h>  
 #include <string.h>
+#include <limits.h>
 #include <assert.h>  
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/wait.h>  
 #include <sys/stat.h>
+#include <sys/epoll.h>
 #include <arpa/inet.h>  
 #include <sys/types.h>
 #include <sys/socket.h>  
 
-#include "mylist.h"
 #include "mdb.h"
+#include "mdb-pool.h"
+#include "mdb-snapshot.h"
+#include "mdb-cache.h"
+#include "mdb-conn.h"
 
-#define KeyMax 5
+// events handled per epoll_wait() call
+#define MaxEvents 256
+
+// a scan is only split across threads if each gets at least this many
+// records; below that the threads cost more than they save
+#define MinPartition 65536
+
+// cap on -t, per online CPU
+#define MaxThreadsPerCpu 4
+
+// seconds between checks of the database file for changes
+#define ReloadInterval 1
+
+// default response cache budget in bytes
+#define CacheBudget (16 * 1024 * 1024)
 
 static void die(const char *s) { perror(s); exit(1); }
 
-int main(int argc, char **argv)
-{   
-    if (argc != 3) {
-        fprintf(stderr, "usage: %s <db_file> <server-port>\n", argv[0]);
-        exit(1);
+/*
+ * Parse a decimal number between 1 and 'max'.
+ * Returns -1 if 'arg' is not one.
+ */
+static int parsePositive(const char *arg, int max)
+{
+    char *end;
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (errno || end == arg || *end != '\0' || n < 1 || n > max)
+        return -1;
+    return n;
+}
+
+/*
+ * Parse a shard of the database: "first:count" or just "first", for
+ * all the records from 'first' (counting from 0) on.
+ * Returns 0 on success and -1 if 'arg' is not one.
+ */
+static int parseShard(const char *arg, int *first, int *count)
+{
+    char *end;
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (errno || end == arg || n < 0 || n > INT_MAX)
+        return -1;
+    *first = n;
+    *count = -1;
+    if (*end == '\0')
+        return 0;
+    if (*end != ':' || (*count = parsePositive(end + 1, INT_MAX)) < 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * More scan threads than this only add contention.
+ */
+static int maxThreads(void)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return MaxThreadsPerCpu * (ncpus > 0 ? ncpus : 1);
+}
+
+/*
+ * Parse a size in bytes, with an optional K, M or G suffix.
+ * Returns 0 on success and -1 if 'arg' is not one.
+ */
+static int parseSize(const char *arg, size_t *size)
+{
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(arg, &end, 10);
+    if (errno || end == arg || *arg == '-')
+        return -1;
+    switch (*end) {
+    case 'G': n *= 1024; // fall through
+    case 'M': n *= 1024; // fall through
+    case 'K': n *= 1024; end++; break;
     }
+    if (*end != '\0')
+        return -1;
+    *size = n;
+    return 0;
+}
 
-    // assign port and filename to correct command line arguments
-    const char *filename = argv[1];
-    unsigned short port = atoi(argv[2]);
-    
-    // create a listening socket (also called server socket) 
-    int servsock;
-    if ((servsock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-        die("socket failed");
+/*
+ * Print the response cache counters whenever we get SIGUSR1.  The
+ * signal is blocked in every other thread, so it is delivered here.
+ */
+static void *statsThread(void *arg)
+{
+    sigset_t *set = (sigset_t *)arg;
+    for (;;) {
+        int sig;
+        if (sigwait(set, &sig) != 0)
+            continue;
+
+        struct CacheStats st;
+        getCacheStats(&st);
+        unsigned long lookups = st.hits + st.misses;
+        fprintf(stderr, "cache: %lu hits, %lu misses (%.1f%% hit ratio), "
+                "%lu inserts, %lu evictions, %lu invalidations, "
+                "%zu entries, %zu of %zu bytes\n",
+                st.hits, st.misses,
+                lookups ? 100.0 * st.hits / lookups : 0.0,
+                st.inserts, st.evictions, st.invalidations,
+                st.entries, st.bytes, st.budget);
+    }
+    return NULL;
+}
 
-    // construct local address structure
-    struct sockaddr_in servaddr;
-    memset(&servaddr, 0, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = htonl(INADDR_ANY); // any network interface
-    servaddr.sin_port = htons(port);
+/*
+ * Block SIGUSR1 (in this thread and every thread started after it) and
+ * start the thread that reports statistics on it.
+ */
+static void startStatsReporter(void)
+{
+    static sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0)
+        die("pthread_sigmask failed");
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, &statsThread, &set) != 0)
+        die("starting stats thread failed");
+    pthread_detach(tid);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-e] [-s | -c] [-k kernel] [-t threads] "
+            "[-P min-records] [-m cache-bytes] [-S first[:count]] "
+            "<db_file> <server-port>\n",
+            prog);
+    fprintf(stderr, "  -e  serve all clients concurrently from an epoll "
+            "event loop\n");
+    fprintf(stderr, "  -s  answer lookups with a linear scan "
+            "instead of the n-gram index\n");
+    fprintf(stderr, "  -c  answer lookups with a vectorized scan "
+            "over a columnar copy of the records\n");
+    fprintf(stderr, "  -k  scan kernel for -c: avx2, sse2 or scalar "
+            "(default: best supported)\n");
+    fprintf(stderr, "  -t  split each scan (-s, -c) across this many "
+            "threads (default: 1)\n");
+    fprintf(stderr, "  -P  only split scans if each thread gets at least "
+            "this many records (default: %d)\n", MinPartition);
+    fprintf(stderr, "  -m  memory budget of the response cache, e.g. 64M; "
+            "0 disables it (default: %dM)\n", CacheBudget / (1024 * 1024));
+    fprintf(stderr, "  -S  only serve the shard of 'count' records starting "
+            "at record 'first'\n      (counting from 0); records keep "
+            "their numbers in the whole file\n");
+    fprintf(stderr, "send SIGUSR1 to print the cache hit/miss counters\n");
+    exit(1);
+}
+
+static int setNonBlocking(int sock)
+{
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+    return 0;
+}
+
+static void closeConn(int epfd, struct Conn *conn)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->sock, NULL);
+
+    // print a msg to report that one client is done
+    fprintf(stderr, "connection terminated from: %s\n", 
+            inet_ntoa(conn->addr.sin_addr));
+    freeConn(conn);
+}
 
-    // bind to the local address
-    if (bind(servsock, (struct sockaddr *) &servaddr, sizeof(servaddr)) < 0)
-        die("bind failed");
+/*
+ * Poll the connection for input while it can take more, and for
+ * output while it has some.
+ */
+static int updateEvents(int epfd, struct Conn *conn)
+{
+    struct epoll_event ev;
+    ev.events = (connWantsInput(conn) ? EPOLLIN : 0)
+        | (connHasOutput(conn) ? EPOLLOUT : 0);
+    ev.data.ptr = conn;
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, conn->sock, &ev);
+}
+
+static void acceptClients(int epfd, int servsock)
+{
+    for (;;) {
+        struct sockaddr_in clntaddr;
+        socklen_t clntlen = sizeof(clntaddr);
+        int clntsock = accept(servsock, (struct sockaddr *) &clntaddr,
+                &clntlen);
+        if (clntsock < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // e.g. out of file descriptors; try again on the next event
+            perror("accept failed");
+            return;
+        }
 
-    // start listening for incoming connections
-    if (listen(servsock, 5 /* queue size for connection requests */ ) < 0)
-        die("listen failed");
+        // a failure here only costs this one client
+        if (setNonBlocking(clntsock) < 0) {
+            perror("fcntl failed");
+            close(clntsock);
+            continue;
+        }
+
+        struct Conn *conn = newConn(clntsock, &clntaddr);
+        if (conn == NULL) {
+            perror("malloc failed");
+            close(clntsock);
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, clntsock, &ev) < 0) {
+            perror("epoll_ctl failed");
+            freeConn(conn);
+            continue;
+        }
+
+        fprintf(stderr, "\nconnection started from: %s\n",
+                inet_ntoa(clntaddr.sin_addr));
+    }
+}
+
+/*
+ * Serve all clients from one thread: every socket is non-blocking and
+ * each connection keeps its own input and output buffers, so a slow or
+ * idle client never holds up the others.
+ */
+static void serveEpoll(int servsock)
+{
+    int epfd = epoll_create1(0);
+    if (epfd < 0)
+        die("epoll_create1 failed");
+
+    if (setNonBlocking(servsock) < 0)
+        die("fcntl failed");
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // marks the listening socket
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, servsock, &ev) < 0)
+        die("epoll_ctl failed");
+
+    struct epoll_event events[MaxEvents];
+    for (;;) {
+        int n = epoll_wait(epfd, events, MaxEvents, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            die("epoll_wait failed");
+        }
+
+        int i;
+        for (i = 0; i < n; i++) {
+            struct Conn *conn = (struct Conn *)events[i].data.ptr;
+            if (conn == NULL) {
+                acceptClients(epfd, servsock);
+                continue;
+            }
+
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)
+                    && connWantsInput(conn)) {
+                if (readConn(conn) < 0 && errno != EAGAIN) {
+                    perror("recv failed");
+                    closeConn(epfd, conn);
+                    continue;
+                }
+            }
+
+            // answer what we can; if the output drains completely,
+            // there is no event coming to resume work that was held
+            // back at the high-water mark, so keep going
+            int err;
+            do {
+                if ((err = processConn(conn)) < 0) {
+                    perror("lookup failed");
+                    break;
+                }
+                if ((err = flushConn(conn)) < 0) {
+                    perror("send content failed");
+                    break;
+                }
+            } while (connHasWork(conn) && !connHasOutput(conn));
+
+            if (err == 0 && !connDone(conn)
+                    && (err = updateEvents(epfd, conn)) < 0)
+                perror("epoll_ctl failed");
+            if (err < 0 || connDone(conn))
+                closeConn(epfd, conn);
+        }
+    }
+}
 
+/*
+ * Serve one client at a time, with blocking sockets.
+ */
+static void serveIterative(int servsock)
+{
     int clntsock;
     socklen_t clntlen;
     struct sockaddr_in clntaddr;
@@ -70,113 +349,165 @@ int main(int argc, char **argv)
         // print out IP address of client
         fprintf(stderr, "\nconnection started from: %s\n",
                 inet_ntoa(clntaddr.sin_addr));
-        
-        /*
-         * open the database file specified in the argument
-         */
 
-        FILE *fp = fopen(filename, "rb"); // open in read, binary mode
-        if (fp == NULL) 
-            die(filename);
+        struct Conn *conn = newConn(clntsock, &clntaddr);
+        if (conn == NULL)
+            die("malloc failed");
 
         /*
-         * read all records into memory
+         * lookup loop
          */
 
-        struct List list;
-        initList(&list);
-
-        struct MdbRec r;
-        struct Node *node = NULL;
-
-        while (fread(&r, sizeof(r), 1, fp) == 1) {
+        for (;;) {
+            if (processConn(conn) < 0) {
+                perror("lookup failed");
+                break;
+            }
 
-            // allocate memory for a new record and copy into it the one
-            // that was just read from the database.
-            struct MdbRec *rec = (struct MdbRec *)malloc(sizeof(r));
-            if (!rec)
-                die("malloc failed");
-            memcpy(rec, &r, sizeof(r));
+            // blocks until everything queued so far is written
+            if (flushConn(conn) < 0) {
+                perror("send content failed");
+                break;
+            }
 
-            // add the record to the linked list.
-            node = addAfter(&list, node, rec);
-            if (node == NULL) 
-                die("addAfter failed");
+            if (connHasWork(conn))
+                continue;
+            if (conn->eof)
+                break;
+            if (readConn(conn) < 0) {
+                perror("recv failed");
+                break;
+            }
         }
 
-        // see if fread() produced error
-        if (ferror(fp)) 
-            die("fread failed");
-
-        // close the database file
-        fclose(fp);
+        // print a msg to report that one client is done
+        fprintf(stderr, "connection terminated from: %s\n", 
+                inet_ntoa(clntaddr.sin_addr));
 
         /*
-         * lookup loop
+         * clean up
          */
 
-        // wrap the socket with a FILE* using fdopen()
-        FILE *input = fdopen(clntsock, "r");
-        if (input == NULL) 
-            die("fdopen failed");
-
-        char line[1000];
-        char key[KeyMax + 1];
-
-        char buf[4096];
-        int size;
-
-        while (fgets(line, sizeof(line), input) != NULL) {
-
-            // must null-terminate the string manually after strncpy().
-            strncpy(key, line, sizeof(key) - 1);
-            key[sizeof(key) - 1] = '\0';
-
-            // if newline is there, remove it.
-            size_t last = strlen(key) - 1;
-            if (key[last] == '\n')
-                key[last] = '\0';
-
-            // traverse the list, printing out the matching records
-            struct Node *node = list.head;
-            int recNo = 1;
-            while (node) {
-                struct MdbRec *rec = (struct MdbRec *)node->data;
-                if (strstr(rec->name, key) || strstr(rec->msg, key)) {
-                    size = sprintf(buf, "%4d: {%s} said {%s}\n", 
-                            recNo, rec->name, rec->msg);
-                    if (send(clntsock, buf, size, 0) != size) {
-                        perror("send content failed");
-                        break;
-                    }
-                }
-                node = node->next;
-                recNo++;
-            }
+        // closes the socket
+        freeConn(conn);
+    }
+}
 
-            // send a blank line to indicate the end of search result
-            size = sprintf(buf, "\n");
-            if (send(clntsock, buf, size, 0) != size)
-                perror("send content failed");
+int main(int argc, char **argv)
+{   
+    struct SnapshotOptions snapOpts = {
+        .reloadInterval = ReloadInterval,
+        .method = LOOKUP_INDEX,
+        .shardFirst = 0,
+        .shardCount = -1,
+    };
+    const char *kernel = NULL;
+    int nthreads = 1;
+    int minPartition = MinPartition;
+    int useEpoll = 0;
+    size_t cacheBudget = CacheBudget;
+
+    int c;
+    while ((c = getopt(argc, argv, "esck:t:P:m:S:")) != -1) {
+        switch (c) {
+        case 'e':
+            useEpoll = 1;
+            break;
+        case 's':
+            snapOpts.method = LOOKUP_SCAN;
+            break;
+        case 'c':
+            snapOpts.method = LOOKUP_COLUMNS;
+            break;
+        case 'k':
+            kernel = optarg;
+            break;
+        case 't':
+            nthreads = parsePositive(optarg, maxThreads());
+            if (nthreads < 0) {
+                fprintf(stderr, "-t must be between 1 and %d\n", maxThreads());
+                usage(argv[0]);
+            }
+            break;
+        case 'P':
+            minPartition = parsePositive(optarg, INT_MAX);
+            if (minPartition < 0) {
+                fprintf(stderr, "-P must be a positive number\n");
+                usage(argv[0]);
+            }
+            break;
+        case 'm':
+            if (parseSize(optarg, &cacheBudget) < 0) {
+                fprintf(stderr, "-m must be a size in bytes\n");
+                usage(argv[0]);
+            }
+            break;
+        case 'S':
+            if (parseShard(optarg, &snapOpts.shardFirst,
+                        &snapOpts.shardCount) < 0) {
+                fprintf(stderr, "-S must be first or first:count\n");
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
         }
+    }
+    if (argc - optind != 2)
+        usage(argv[0]);
 
-        // check if fgets() produced error
-        if (ferror(input)) {
-            perror("fgets failed to read from input");
-        }
+    // assign port and filename to correct command line arguments
+    const char *filename = argv[optind];
+    unsigned short port = atoi(argv[optind + 1]);
 
-        /*
-         * clean up and quit
-         */
+    if (kernel && snapOpts.method != LOOKUP_COLUMNS) {
+        fprintf(stderr, "-k only applies to -c\n");
+        usage(argv[0]);
+    }
+    if (selectScanKernel(kernel) < 0) {
+        fprintf(stderr, "scan kernel %s is not supported\n", kernel);
+        exit(1);
+    }
+    if (snapOpts.method == LOOKUP_COLUMNS)
+        fprintf(stderr, "using %s scan kernel\n", scanKernelName());
 
-        traverseList(&list, &free);
-        removeAllNodes(&list);
+    // before any other thread is started, so they inherit the mask
+    startStatsReporter();
 
-        // close the socket by closing the FILE* wrapper
-        fclose(input);
+    if (initCache(cacheBudget) < 0)
+        die("allocating the response cache failed");
 
-        // print a msg to report that one client is done
-        fprintf(stderr, "connection terminated from: %s\n", 
-                inet_ntoa(clntaddr.sin_addr));
-    }
-}
\ No newline at end of file
+    if (startScanPool(nthreads, minPartition) < 0)
+        die("starting scan threads failed");
+
+    // load the database once; it is reloaded in the background
+    // whenever the file changes
+    if (startSnapshots(filename, &snapOpts) < 0)
+        die(filename);
+    
+    // create a listening socket (also called server socket) 
+    int servsock;
+    if ((servsock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        die("socket failed");
+
+    // construct local address structure
+    struct sockaddr_in servaddr;
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_ANY); // any network interface
+    servaddr.sin_port = htons(port);
+
+    // bind to the local address
+    if (bind(servsock, (struct sockaddr *) &servaddr, sizeof(servaddr)) < 0)
+        die("bind failed");
+
+    // start listening for incoming connections
+    if (listen(servsock, useEpoll ? SOMAXCONN : 5 /* queue size */ ) < 0)
+        die("listen failed");
+
+    // neither returns
+    if (useEpoll)
+        serveEpoll(servsock);
+    else
+        serveIterative(servsock);
+}
@@ -0,0 +1,146 @@
+/*
+ * mdb-pool.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mdb.h"
+#include "mdb-pool.h"
+
+/*
+ * One partition of a scan.  Jobs live on the stack of the thread that
+ * called parallelScan(), which waits for all of them to finish.
+ */
+struct Job {
+    RangeScan scan;
+    const void *arg;
+    int from, to;
+    struct MdbHits hits;
+    int err;
+
+    int *pending;       // jobs of the same scan still running
+    struct Job *next;   // in the queue
+};
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+
+// protected by poolLock
+static struct Job *queueHead;
+static struct Job *queueTail;
+
+static int partitions = 1;
+static int minRecs;
+
+static void *worker(void *unused)
+{
+    pthread_mutex_lock(&poolLock);
+    for (;;) {
+        while (queueHead == NULL)
+            pthread_cond_wait(&workCond, &poolLock);
+
+        struct Job *job = queueHead;
+        queueHead = job->next;
+        if (queueHead == NULL)
+            queueTail = NULL;
+
+        pthread_mutex_unlock(&poolLock);
+        job->err = job->scan(job->arg, job->from, job->to, &job->hits);
+        pthread_mutex_lock(&poolLock);
+
+        if (--*job->pending == 0)
+            pthread_cond_broadcast(&doneCond);
+    }
+    return NULL;
+}
+
+int startScanPool(int nthreads, int minPartition)
+{
+    minRecs = minPartition > 1 ? minPartition : 1;
+
+    // only ever split as many ways as there are threads to run the
+    // partitions, even if not all of them could be started; idle
+    // workers just wait for jobs that never come
+    int i;
+    for (i = 1; i < nthreads; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, &worker, NULL) != 0)
+            return -1;
+        pthread_detach(tid);
+        partitions = i + 1;
+    }
+    return 0;
+}
+
+static int appendHits(struct MdbHits *dst, const struct MdbHits *src)
+{
+    if (dst->count + src->count > dst->cap) {
+        int cap = dst->count + src->count;
+        int *recs = (int *)realloc(dst->recs, cap * sizeof(int));
+        if (recs == NULL)
+            return -1;
+        dst->recs = recs;
+        dst->cap = cap;
+    }
+    memcpy(dst->recs + dst->count, src->recs, src->count * sizeof(int));
+    dst->count += src->count;
+    return 0;
+}
+
+int parallelScan(RangeScan scan, const void *arg, int count,
+        struct MdbHits *hits)
+{
+    int n = partitions;
+    if (count / minRecs < n)
+        n = count / minRecs;
+    if (n <= 1)
+        return scan(arg, 0, count, hits);
+
+    // partition 0 is ours, the rest go to the pool
+    struct Job jobs[n];
+    int pending = n - 1;
+    int i;
+    for (i = 0; i < n; i++) {
+        jobs[i].scan = scan;
+        jobs[i].arg = arg;
+        jobs[i].from = (long long)count * i / n;
+        jobs[i].to = (long long)count * (i + 1) / n;
+        initHits(&jobs[i].hits);
+        jobs[i].err = 0;
+        jobs[i].pending = &pending;
+        jobs[i].next = NULL;
+    }
+
+    pthread_mutex_lock(&poolLock);
+    for (i = 1; i < n; i++) {
+        if (queueTail)
+            queueTail->next = &jobs[i];
+        else
+            queueHead = &jobs[i];
+        queueTail = &jobs[i];
+    }
+    pthread_cond_broadcast(&workCond);
+    pthread_mutex_unlock(&poolLock);
+
+    // our own partition goes straight into the result
+    int err = scan(arg, jobs[0].from, jobs[0].to, hits);
+
+    pthread_mutex_lock(&poolLock);
+    while (pending > 0)
+        pthread_cond_wait(&doneCond, &poolLock);
+    pthread_mutex_unlock(&poolLock);
+
+    // partitions are contiguous and in order, so concatenating them
+    // gives the matches in record order
+    for (i = 1; i < n; i++) {
+        if (err == 0 && jobs[i].err == 0)
+            err = appendHits(hits, &jobs[i].hits);
+        else
+            err = -1;
+        freeHits(&jobs[i].hits);
+    }
+    return err;
+}
@@ -0,0 +1,43 @@
+/*
+ * mdb-pool.h
+ */
+
+#ifndef _MDB_POOL_H_
+#define _MDB_POOL_H_
+
+#include "mdb.h"
+
+/*
+ * Scans records 'from' up to (not including) 'to' and appends the
+ * matches to 'hits' in record order.  Returns 0 on success, -1 on
+ * failure.  'arg' carries the query; it is shared by all partitions
+ * and must not be modified.
+ */
+typedef int (*RangeScan)(const void *arg, int from, int to,
+        struct MdbHits *hits);
+
+/*
+ * Start a pool of persistent scan threads.  A scan is split into
+ * 'nthreads' partitions (the calling thread scans one of them itself,
+ * so nthreads - 1 threads are started), but only if every partition
+ * gets at least 'minPartition' records; smaller scans run on the
+ * calling thread alone.
+ *
+ * Returns 0 on success and -1 if the threads could not be started.
+ * After a failure, scans are split only across the threads that did
+ * start.
+ */
+int startScanPool(int nthreads, int minPartition);
+
+/*
+ * Run 'scan' over records 0 to count - 1, in parallel if the pool is
+ * running and 'count' is big enough, and append the matches to 'hits'
+ * in record order, exactly as a single scan over all records would.
+ * Safe to call from several threads at once.
+ *
+ * Returns 0 on success and -1 if any partition failed.
+ */
+int parallelScan(RangeScan scan, const void *arg, int count,
+        struct MdbHits *hits);
+
+#endif /* _MDB_POOL_H_ */
@@ -0,0 +1,62 @@
+/*
+ * mdb-proto.h
+ */
+
+#ifndef _MDB_PROTO_H_
+#define _MDB_PROTO_H_
+
+#include <stdint.h>
+
+/*
+ * The binary lookup protocol.
+ *
+ * By default a connection speaks the text protocol: a key per line,
+ * answered by one "%4d: {name} said {msg}" line per matching record
+ * and a blank line.  A client that sends BinaryHello as the very
+ * first byte of the connection speaks the binary protocol instead; the
+ * server confirms by sending BinaryHello back before anything else.
+ * (BinaryHello can't start a text request: it is not ASCII, nor the
+ * first byte of any UTF-8 character.)
+ *
+ * A binary request is a key prefixed with its length:
+ *
+ *     keyLen  1 byte
+ *     key     keyLen bytes
+ *
+ * and its response carries the key that was looked up (at most KeyMax
+ * characters, as with the text protocol), the number of matching
+ * records and the records themselves, exactly as they are stored in
+ * the database:
+ *
+ *     keyLen  1 byte
+ *     key     keyLen bytes
+ *     count   4 bytes
+ *     count times:
+ *         recNo   4 bytes
+ *         name    16 bytes
+ *         msg     24 bytes
+ *
+ * Integers are unsigned and in network byte order.  Requests may be
+ * pipelined in both protocols; responses come back in request order.
+ */
+
+#define BinaryHello 0xB1
+
+// the bytes of a record in a response
+#define BinaryRecSize (4 + 16 + 24)
+
+static inline void putBinaryU32(unsigned char *p, uint32_t n)
+{
+    p[0] = n >> 24;
+    p[1] = n >> 16;
+    p[2] = n >> 8;
+    p[3] = n;
+}
+
+static inline uint32_t getBinaryU32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16
+        | (uint32_t)p[2] << 8 | p[3];
+}
+
+#endif /* _MDB_PROTO_H_ */
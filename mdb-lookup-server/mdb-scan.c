@@ -0,0 +1,246 @@
+/*
+ * mdb-scan.c
+ *
+ * Substring scan kernels over the columnar record layout.
+ *
+ * The vector kernels are a first/last-character filter: for each field
+ * they compare every byte with the first and with the last character
+ * of the key at once, shift the last-character mask back by keyLen - 1
+ * and AND the two.  What survives, restricted to the positions where
+ * the key would end before the field's terminating NUL, is a candidate
+ * that is confirmed with memcmp().  Most fields produce no candidate
+ * at all, so most records cost a couple of compares and a movemask.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mdb.h"
+#include "mdb-scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+int buildColumns(const struct MdbStore *db, struct MdbColumns *cols)
+{
+    size_t n = db->count;
+
+    cols->count = db->count;
+    cols->names = (char *)calloc(1, n * NameLen + ColumnPad);
+    cols->msgs = (char *)calloc(1, n * MsgLen + ColumnPad);
+    if (cols->names == NULL || cols->msgs == NULL) {
+        freeColumns(cols);
+        return -1;
+    }
+
+    size_t i;
+    for (i = 0; i < n; i++) {
+        memcpy(cols->names + i * NameLen, db->recs[i].name, NameLen);
+        memcpy(cols->msgs + i * MsgLen, db->recs[i].msg, MsgLen);
+    }
+    return 0;
+}
+
+void freeColumns(struct MdbColumns *cols)
+{
+    free(cols->names);
+    free(cols->msgs);
+    cols->names = NULL;
+    cols->msgs = NULL;
+    cols->count = 0;
+}
+
+/*
+ * Given the masks of the positions in a field holding the key's first
+ * character, its last character and NUL (with a sentinel bit set at
+ * the field length), return 1 if the key occurs in the field.
+ */
+static inline int confirm(const char *field, uint32_t first, uint32_t last,
+        uint32_t nul, const char *key, size_t keyLen)
+{
+    // the key has to end before the first NUL
+    unsigned len = __builtin_ctz(nul);
+    if (len < keyLen)
+        return 0;
+    uint32_t cand = first & (last >> (keyLen - 1));
+    cand &= (uint32_t)((2ull << (len - keyLen)) - 1);
+
+    while (cand) {
+        unsigned p = __builtin_ctz(cand);
+        if (keyLen <= 2 || memcmp(field + p + 1, key + 1, keyLen - 2) == 0)
+            return 1;
+        cand &= cand - 1;
+    }
+    return 0;
+}
+
+static int scanScalar(const struct MdbColumns *cols, int from, int to,
+        const char *key, size_t keyLen, struct MdbHits *hits)
+{
+    int i;
+    for (i = from; i < to; i++) {
+        if ((mdbFieldContains(cols->names + (size_t)i * NameLen, NameLen,
+                        key, keyLen)
+                    || mdbFieldContains(cols->msgs + (size_t)i * MsgLen, MsgLen,
+                        key, keyLen))
+                && addHit(hits, i) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static int scanSSE2(const struct MdbColumns *cols, int from, int to,
+        const char *key, size_t keyLen, struct MdbHits *hits)
+{
+    const __m128i vf = _mm_set1_epi8(key[0]);
+    const __m128i vl = _mm_set1_epi8(key[keyLen - 1]);
+    const __m128i vz = _mm_setzero_si128();
+    int i;
+
+    for (i = from; i < to; i++) {
+        // one name per register
+        const char *name = cols->names + (size_t)i * NameLen;
+        __m128i v = _mm_loadu_si128((const __m128i *)name);
+        uint32_t first = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vf));
+        uint32_t last = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vl));
+        uint32_t nul = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vz)) | 1u << NameLen;
+        if (first && confirm(name, first, last, nul, key, keyLen)) {
+            if (addHit(hits, i) < 0)
+                return -1;
+            continue;
+        }
+
+        // a msg is two overlapping registers: bytes 0-15 and 8-23
+        const char *msg = cols->msgs + (size_t)i * MsgLen;
+        __m128i lo = _mm_loadu_si128((const __m128i *)msg);
+        __m128i hi = _mm_loadu_si128((const __m128i *)(msg + 8));
+        first = _mm_movemask_epi8(_mm_cmpeq_epi8(lo, vf))
+            | _mm_movemask_epi8(_mm_cmpeq_epi8(hi, vf)) << 8;
+        last = _mm_movemask_epi8(_mm_cmpeq_epi8(lo, vl))
+            | _mm_movemask_epi8(_mm_cmpeq_epi8(hi, vl)) << 8;
+        nul = _mm_movemask_epi8(_mm_cmpeq_epi8(lo, vz))
+            | _mm_movemask_epi8(_mm_cmpeq_epi8(hi, vz)) << 8
+            | 1u << MsgLen;
+        if (first && confirm(msg, first, last, nul, key, keyLen)
+                && addHit(hits, i) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+__attribute__((target("avx2")))
+static int scanAVX2(const struct MdbColumns *cols, int from, int to,
+        const char *key, size_t keyLen, struct MdbHits *hits)
+{
+    const __m256i vf = _mm256_set1_epi8(key[0]);
+    const __m256i vl = _mm256_set1_epi8(key[keyLen - 1]);
+    const __m256i vz = _mm256_setzero_si256();
+    const uint32_t msgMask = (1u << MsgLen) - 1;
+    int i = from;
+
+    while (i < to) {
+        // two names per register; the second one may be past 'to' but
+        // is still inside the padded array
+        const char *name = cols->names + (size_t)i * NameLen;
+        __m256i v = _mm256_loadu_si256((const __m256i *)name);
+        uint32_t first2 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vf));
+        uint32_t last2 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vl));
+        uint32_t nul2 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vz));
+
+        int k;
+        for (k = 0; k < 2 && i < to; k++, i++, name += NameLen) {
+            int shift = k * NameLen;
+            uint32_t first = first2 >> shift & 0xffff;
+            uint32_t last = last2 >> shift & 0xffff;
+            int found = 0;
+            if (first)
+                found = confirm(name, first, last,
+                        (nul2 >> shift & 0xffff) | 1u << NameLen,
+                        key, keyLen);
+
+            if (!found) {
+                // one msg per register, the rest belongs to the next
+                const char *msg = cols->msgs + (size_t)i * MsgLen;
+                __m256i m = _mm256_loadu_si256((const __m256i *)msg);
+                first = _mm256_movemask_epi8(_mm256_cmpeq_epi8(m, vf)) & msgMask;
+                last = _mm256_movemask_epi8(_mm256_cmpeq_epi8(m, vl)) & msgMask;
+                if (first) {
+                    uint32_t nul = (_mm256_movemask_epi8(
+                                _mm256_cmpeq_epi8(m, vz)) & msgMask)
+                        | 1u << MsgLen;
+                    found = confirm(msg, first, last, nul, key, keyLen);
+                }
+            }
+
+            if (found && addHit(hits, i) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+typedef int (*ScanKernel)(const struct MdbColumns *, int, int,
+        const char *, size_t, struct MdbHits *);
+
+static ScanKernel kernel = &scanScalar;
+static const char *kernelName = "scalar";
+
+int selectScanKernel(const char *name)
+{
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    int avx2 = __builtin_cpu_supports("avx2");
+    int sse2 = __builtin_cpu_supports("sse2");
+#else
+    int avx2 = 0, sse2 = 0;
+#endif
+
+    if (name == NULL)
+        name = avx2 ? "avx2" : sse2 ? "sse2" : "scalar";
+
+    if (strcmp(name, "scalar") == 0) {
+        kernel = &scanScalar;
+        kernelName = "scalar";
+        return 0;
+    }
+#ifdef HAVE_X86_KERNELS
+    if (strcmp(name, "sse2") == 0 && sse2) {
+        kernel = &scanSSE2;
+        kernelName = "sse2";
+        return 0;
+    }
+    if (strcmp(name, "avx2") == 0 && avx2) {
+        kernel = &scanAVX2;
+        kernelName = "avx2";
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+const char *scanKernelName(void)
+{
+    return kernelName;
+}
+
+int scanColumns(const struct MdbColumns *cols, int from, int to,
+        const char *key, size_t keyLen, struct MdbHits *hits)
+{
+    // everything matches the empty key
+    if (keyLen == 0) {
+        int i;
+        for (i = from; i < to; i++)
+            if (addHit(hits, i) < 0)
+                return -1;
+        return 0;
+    }
+    return kernel(cols, from, to, key, keyLen, hits);
+}
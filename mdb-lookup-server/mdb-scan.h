@@ -0,0 +1,65 @@
+/*
+ * mdb-scan.h
+ */
+
+#ifndef _MDB_SCAN_H_
+#define _MDB_SCAN_H_
+
+#include <stddef.h>
+
+#include "mdb.h"
+
+#define NameLen sizeof(((struct MdbRec *)0)->name)
+#define MsgLen  sizeof(((struct MdbRec *)0)->msg)
+
+/*
+ * The records of a database in struct-of-arrays form: the names of
+ * all records back to back, then the msgs.  This lets the scan kernels
+ * load whole fields (and more than one name) per vector instruction.
+ * Both arrays are padded so that a kernel may read up to ColumnPad
+ * bytes past the last field.
+ */
+#define ColumnPad 32
+
+struct MdbColumns {
+    char *names;    // count * NameLen bytes
+    char *msgs;     // count * MsgLen bytes
+    int count;
+};
+
+/*
+ * Copy the records of 'db' into 'cols'.
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int buildColumns(const struct MdbStore *db, struct MdbColumns *cols);
+
+/*
+ * Free the memory held by 'cols'.
+ */
+void freeColumns(struct MdbColumns *cols);
+
+/*
+ * Select the scan kernel.  'name' is one of "avx2", "sse2" or
+ * "scalar", or NULL to pick the fastest one the CPU supports.
+ *
+ * Returns 0 on success and -1 if the kernel is unknown or not
+ * supported by this CPU.
+ */
+int selectScanKernel(const char *name);
+
+/*
+ * Name of the kernel in use.
+ */
+const char *scanKernelName(void);
+
+/*
+ * Find the records 'from' up to (not including) 'to' that match 'key',
+ * and append them to 'hits'.  The result is exactly that of
+ * scanmdbRange() on the database the columns were built from.
+ *
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int scanColumns(const struct MdbColumns *cols, int from, int to,
+        const char *key, size_t keyLen, struct MdbHits *hits);
+
+#endif /* _MDB_SCAN_H_ */
@@ -0,0 +1,254 @@
+/*
+ * mdb-snapshot.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "mdb.h"
+#include "mdb-pool.h"
+#include "mdb-cache.h"
+#include "mdb-snapshot.h"
+
+static pthread_mutex_t snapLock = PTHREAD_MUTEX_INITIALIZER;
+static struct MdbSnapshot *current;    // protected by snapLock
+
+static const char *dbFilename;
+static struct SnapshotOptions options;
+
+static int sameFile(const struct MdbSnapshot *snap, const struct stat *st)
+{
+    return snap->dev == st->st_dev
+        && snap->ino == st->st_ino
+        && snap->size == st->st_size
+        && snap->mtime.tv_sec == st->st_mtim.tv_sec
+        && snap->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void freeSnapshot(struct MdbSnapshot *snap)
+{
+    if (options.method == LOOKUP_INDEX)
+        freeIndex(&snap->index);
+    else if (options.method == LOOKUP_COLUMNS)
+        freeColumns(&snap->columns);
+    freemdb(&snap->db);
+    free(snap);
+}
+
+/*
+ * Build a new snapshot from the database file.
+ * Returns NULL (with errno set) on failure.
+ */
+static struct MdbSnapshot *loadSnapshot(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct MdbSnapshot *snap = malloc(sizeof(*snap));
+    if (snap == NULL) {
+        close(fd);
+        return NULL;
+    }
+    memset(snap, 0, sizeof(*snap));
+
+    // take the identity from the open file so that a rename that
+    // races with the load is caught on the next poll
+    struct stat st;
+    int count = -1;
+    if (fstat(fd, &st) == 0)
+        count = loadmdb(fd, &snap->db, options.shardFirst, options.shardCount);
+    if (count < 0) {
+        free(snap);
+        close(fd);
+        return NULL;
+    }
+    close(fd); // the mapping keeps the file alive
+
+    int err = 0;
+    if (options.method == LOOKUP_INDEX)
+        err = buildIndex(&snap->db, &snap->index);
+    else if (options.method == LOOKUP_COLUMNS)
+        err = buildColumns(&snap->db, &snap->columns);
+    if (err < 0) {
+        freemdb(&snap->db);
+        free(snap);
+        return NULL;
+    }
+
+    snap->dev = st.st_dev;
+    snap->ino = st.st_ino;
+    snap->size = st.st_size;
+    snap->mtime = st.st_mtim;
+    snap->refs = 1; // the reference held by 'current'
+    return snap;
+}
+
+static void publishSnapshot(struct MdbSnapshot *snap)
+{
+    static unsigned long lastGen;
+
+    pthread_mutex_lock(&snapLock);
+    struct MdbSnapshot *old = current;
+    snap->gen = ++lastGen;
+    current = snap;
+    pthread_mutex_unlock(&snapLock);
+
+    // cached responses came from the old records; responses still
+    // being computed from them are refused by generation
+    cacheInvalidate(snap->gen);
+
+    // readers still using the old snapshot keep it alive
+    if (old)
+        releaseSnapshot(old);
+}
+
+static void *reloadThread(void *arg)
+{
+    for (;;) {
+        sleep(options.reloadInterval);
+
+        struct stat st;
+        if (stat(dbFilename, &st) < 0)
+            continue; // probably being replaced; keep serving the old one
+
+        // 'current' is only ever replaced by this thread
+        if (sameFile(current, &st))
+            continue;
+
+        struct MdbSnapshot *snap = loadSnapshot(dbFilename);
+        if (snap == NULL) {
+            perror("reloading database failed");
+            continue;
+        }
+        publishSnapshot(snap);
+        fprintf(stderr, "reloaded %s: %d records\n", dbFilename, snap->db.count);
+    }
+    return NULL;
+}
+
+int startSnapshots(const char *filename, const struct SnapshotOptions *opts)
+{
+    dbFilename = filename;
+    options = *opts;
+
+    struct MdbSnapshot *snap = loadSnapshot(filename);
+    if (snap == NULL)
+        return -1;
+    publishSnapshot(snap);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, &reloadThread, NULL) != 0)
+        return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+struct MdbSnapshot *acquireSnapshot(void)
+{
+    pthread_mutex_lock(&snapLock);
+    struct MdbSnapshot *snap = current;
+    snap->refs++;
+    pthread_mutex_unlock(&snapLock);
+    return snap;
+}
+
+void releaseSnapshot(struct MdbSnapshot *snap)
+{
+    pthread_mutex_lock(&snapLock);
+    int refs = --snap->refs;
+    pthread_mutex_unlock(&snapLock);
+
+    if (refs == 0)
+        freeSnapshot(snap);
+}
+
+/*
+ * A lookup, as handed to the scan pool.
+ */
+struct Query {
+    const struct MdbSnapshot *snap;
+    const char *key;
+    size_t keyLen;
+};
+
+static int scanRecords(const void *arg, int from, int to,
+        struct MdbHits *hits)
+{
+    const struct Query *q = (const struct Query *)arg;
+    return scanmdbRange(&q->snap->db, from, to, q->key, q->keyLen, hits);
+}
+
+static int scanColumnRange(const void *arg, int from, int to,
+        struct MdbHits *hits)
+{
+    const struct Query *q = (const struct Query *)arg;
+    return scanColumns(&q->snap->columns, from, to, q->key, q->keyLen, hits);
+}
+
+int lookupSnapshot(const struct MdbSnapshot *snap,
+        const char *key, size_t keyLen, struct MdbHits *hits)
+{
+    struct Query q = { snap, key, keyLen };
+
+    switch (options.method) {
+    case LOOKUP_INDEX:
+        return lookupIndex(&snap->index, &snap->db, key, keyLen, hits);
+    case LOOKUP_COLUMNS:
+        return parallelScan(&scanColumnRange, &q, snap->db.count, hits);
+    default:
+        return parallelScan(&scanRecords, &q, snap->db.count, hits);
+    }
+}
+
+/*
+ * A batch of lookups, as handed to the scan pool.
+ */
+struct BatchQuery {
+    const struct MdbSnapshot *snap;
+    const struct MdbKeySet *keys;
+};
+
+static int scanBatchRange(const void *arg, int from, int to,
+        struct MdbHits *hits)
+{
+    const struct BatchQuery *q = (const struct BatchQuery *)arg;
+    return scanmdbKeys(&q->snap->db, from, to, q->keys, hits);
+}
+
+int lookupSnapshotBatch(const struct MdbSnapshot *snap, int nkeys,
+        const char *const keys[], const size_t keyLens[],
+        struct MdbHits hits[])
+{
+    int k, i;
+
+    // the index does not scan, so there is nothing to share
+    if (nkeys == 1 || options.method == LOOKUP_INDEX) {
+        for (k = 0; k < nkeys; k++) {
+            if (lookupSnapshot(snap, keys[k], keyLens[k], &hits[k]) < 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    struct MdbKeySet set;
+    if (initKeySet(&set, nkeys, keys, keyLens) < 0)
+        return -1;
+
+    // the matches come back as (key, record) pairs, in record order
+    // for each key
+    struct BatchQuery q = { snap, &set };
+    struct MdbHits pairs;
+    initHits(&pairs);
+    int err = parallelScan(&scanBatchRange, &q, snap->db.count, &pairs);
+    for (i = 0; i < pairs.count && err == 0; i += 2)
+        err = addHit(&hits[pairs.recs[i]], pairs.recs[i + 1]);
+    freeHits(&pairs);
+    freeKeySet(&set);
+    return err;
+}
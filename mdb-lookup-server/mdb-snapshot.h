@@ -0,0 +1,107 @@
+/*
+ * mdb-snapshot.h
+ */
+
+#ifndef _MDB_SNAPSHOT_H_
+#define _MDB_SNAPSHOT_H_
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "mdb.h"
+#include "mdb-index.h"
+#include "mdb-scan.h"
+
+/*
+ * A read-only, reference-counted view of the database as it was when
+ * it was loaded.  Readers acquire the current snapshot, run their
+ * query against it, and release it.  A snapshot is never modified
+ * after it is published; when the database file changes, a new one is
+ * built and swapped in, and the old one is freed once its last reader
+ * releases it.
+ */
+struct MdbSnapshot {
+    struct MdbStore db; // records, in file order
+    struct MdbIndex index;      // if built with LOOKUP_INDEX
+    struct MdbColumns columns;  // if built with LOOKUP_COLUMNS
+
+    // identity of the file the snapshot was loaded from
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+
+    unsigned long gen;  // increases with every snapshot published
+    int refs;           // protected by the snapshot lock
+};
+
+/*
+ * How lookups are answered.  Each snapshot builds what its method
+ * needs when it is loaded.
+ */
+enum LookupMethod {
+    LOOKUP_INDEX,       // n-gram index (the default)
+    LOOKUP_SCAN,        // test every record in place
+    LOOKUP_COLUMNS,     // vectorized scan over a columnar copy
+};
+
+/*
+ * How snapshots are built.
+ */
+struct SnapshotOptions {
+    unsigned int reloadInterval;    // seconds between checks of the file
+    enum LookupMethod method;
+
+    // only load records shardFirst (from 0) up to shardFirst +
+    // shardCount of the file; shardCount is -1 for all the rest
+    int shardFirst;
+    int shardCount;
+};
+
+/*
+ * Load 'filename' and publish it as the current snapshot, then start a
+ * background thread that polls the file every 'opts->reloadInterval'
+ * seconds and swaps in a fresh snapshot whenever its inode, size or
+ * mtime change.  A failed reload is reported on stderr and the old
+ * snapshot is kept.  Publishing a snapshot invalidates the response
+ * cache.
+ *
+ * Returns 0 on success and -1 if the initial load failed.
+ */
+int startSnapshots(const char *filename, const struct SnapshotOptions *opts);
+
+/*
+ * Return the current snapshot with a reference held on it.  The
+ * caller must hand it back with releaseSnapshot() when done.
+ */
+struct MdbSnapshot *acquireSnapshot(void);
+
+/*
+ * Drop a reference obtained from acquireSnapshot().  The snapshot is
+ * freed when it has been replaced and this was its last reader.
+ */
+void releaseSnapshot(struct MdbSnapshot *snap);
+
+/*
+ * Find the records of 'snap' matching 'key' with the configured
+ * lookup method, and append them to 'hits'.
+ *
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int lookupSnapshot(const struct MdbSnapshot *snap,
+        const char *key, size_t keyLen, struct MdbHits *hits);
+
+/*
+ * Look up 'nkeys' keys at once and append the records of 'snap'
+ * matching keys[k] to hits[k].  With the scan methods, all the keys
+ * are looked for in one (parallel) pass over the records with
+ * scanmdbKeys(), so a batch costs about one scan instead of one per
+ * key.  The index answers the keys one by one.
+ *
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int lookupSnapshotBatch(const struct MdbSnapshot *snap, int nkeys,
+        const char *const keys[], const size_t keyLens[],
+        struct MdbHits hits[]);
+
+#endif /* _MDB_SNAPSHOT_H_ */
@@ -5,47 +5,234 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#include "mylist.h"
 #include "mdb.h"
 
-int loadmdb(FILE *fp, struct List *dest) 
+int loadmdb(int fd, struct MdbStore *db, int first, int max) 
 {
-    /*
-     * read all records into memory
-     */
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return -1;
 
-    struct MdbRec r;
-    struct Node *node = NULL;
-    int count = 0;
+    db->recs = NULL;
+    db->count = 0;
+    db->first = first;
+    db->map = NULL;
+    db->mapLen = 0;
 
-    while (fread(&r, sizeof(r), 1, fp) == 1) {
+    // only the records that were in the file when it was loaded are
+    // ever read, whatever size the file grows to afterwards
+    off_t start = (off_t)first * sizeof(struct MdbRec);
+    if (st.st_size <= start)
+        return 0;
+    size_t len = st.st_size - start;
+    if (max >= 0 && len > (size_t)max * sizeof(struct MdbRec))
+        len = (size_t)max * sizeof(struct MdbRec);
 
-        // allocate memory for a new record and copy into it the one
-        // that was just read from the database.
-        struct MdbRec *rec = (struct MdbRec *)malloc(sizeof(r));
-        if (!rec)
-            return -1;
-        memcpy(rec, &r, sizeof(r));
+    // a trailing partial record is ignored, just like fread() would
+    size_t count = len / sizeof(struct MdbRec);
+
+    // mmap() refuses zero-length mappings
+    if (count == 0)
+        return 0;
+
+    // the mapping has to start on a page boundary, and a shard
+    // generally doesn't
+    off_t offset = start - start % sysconf(_SC_PAGESIZE);
+    size_t mapLen = (start - offset) + count * sizeof(struct MdbRec);
+    void *map = mmap(NULL, mapLen, PROT_READ, MAP_SHARED, fd, offset);
+    if (map == MAP_FAILED)
+        return -1;
+
+    // lookups walk the records front to back
+    madvise(map, mapLen, MADV_SEQUENTIAL);
+
+    db->recs = (const struct MdbRec *)((char *)map + (start - offset));
+    db->count = count;
+    db->map = map;
+    db->mapLen = mapLen;
+    return count;
+}
+
+void freemdb(struct MdbStore *db) 
+{
+    if (db->map)
+        munmap(db->map, db->mapLen);
+    db->recs = NULL;
+    db->count = 0;
+    db->map = NULL;
+    db->mapLen = 0;
+}
+
+int mdbFieldContains(const char *field, size_t cap,
+        const char *key, size_t keyLen)
+{
+    size_t len = strnlen(field, cap);
+    if (keyLen > len)
+        return 0;
+    for (size_t i = 0; i + keyLen <= len; i++) {
+        if (field[i] == key[0] && memcmp(field + i, key, keyLen) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+int mdbRecMatches(const struct MdbRec *rec, const char *key, size_t keyLen)
+{
+    if (keyLen == 0)
+        return 1; // strstr() finds the empty string everywhere
 
-        // add the record to the linked list.
-        node = addAfter(dest, node, rec);
-        if (node == NULL) 
+    return mdbFieldContains(rec->name, sizeof(rec->name), key, keyLen)
+        || mdbFieldContains(rec->msg, sizeof(rec->msg), key, keyLen);
+}
+
+int addHit(struct MdbHits *hits, int rec)
+{
+    if (hits->count == hits->cap) {
+        int cap = hits->cap ? hits->cap * 2 : 64;
+        int *recs = (int *)realloc(hits->recs, cap * sizeof(int));
+        if (recs == NULL)
             return -1;
+        hits->recs = recs;
+        hits->cap = cap;
+    }
+    hits->recs[hits->count++] = rec;
+    return 0;
+}
+
+void freeHits(struct MdbHits *hits)
+{
+    free(hits->recs);
+    initHits(hits);
+}
+
+int scanmdb(const struct MdbStore *db, const char *key, size_t keyLen,
+        struct MdbHits *hits)
+{
+    return scanmdbRange(db, 0, db->count, key, keyLen, hits);
+}
 
-        count++;
+int scanmdbRange(const struct MdbStore *db, int from, int to,
+        const char *key, size_t keyLen, struct MdbHits *hits)
+{
+    int i;
+    for (i = from; i < to; i++) {
+        if (mdbRecMatches(&db->recs[i], key, keyLen) && addHit(hits, i) < 0)
+            return -1;
     }
+    return 0;
+}
+
+static inline unsigned int pairBucket(unsigned char c0, unsigned char c1)
+{
+    return (c0 * 31u + c1) & (KeyPairBuckets - 1);
+}
 
-    // see if fread() produced error
-    if (ferror(fp)) 
+int initKeySet(struct MdbKeySet *set, int nkeys,
+        const char *const keys[], const size_t keyLens[])
+{
+    int k, c;
+
+    set->keys = keys;
+    set->keyLens = keyLens;
+    set->nkeys = nkeys;
+    set->empty = -1;
+    for (c = 0; c < 256; c++)
+        set->byChar[c] = -1;
+    for (c = 0; c < KeyPairBuckets; c++)
+        set->byPair[c] = -1;
+
+    set->next = (int *)malloc(nkeys * sizeof(int));
+    if (set->next == NULL && nkeys > 0)
         return -1;
 
-    return count;
+    // push in reverse so that every list is in key order
+    for (k = nkeys - 1; k >= 0; k--) {
+        const unsigned char *key = (const unsigned char *)keys[k];
+        int *head;
+        if (keyLens[k] == 0)
+            head = &set->empty;
+        else if (keyLens[k] == 1)
+            head = &set->byChar[key[0]];
+        else
+            head = &set->byPair[pairBucket(key[0], key[1])];
+        set->next[k] = *head;
+        *head = k;
+    }
+    return 0;
+}
+
+void freeKeySet(struct MdbKeySet *set)
+{
+    free(set->next);
+    set->next = NULL;
+}
+
+/*
+ * Append a (key, record) pair for every key of 'set' found in 'field'
+ * that hasn't already matched record 'rec' (as recorded in 'seen').
+ */
+static int matchField(const struct MdbKeySet *set, const char *field,
+        size_t cap, int rec, int *seen, struct MdbHits *hits)
+{
+    const unsigned char *f = (const unsigned char *)field;
+    size_t len = strnlen(field, cap);
+    size_t i;
+    int k;
+
+    for (i = 0; i < len; i++) {
+        for (k = set->byChar[f[i]]; k >= 0; k = set->next[k]) {
+            if (seen[k] != rec) {
+                seen[k] = rec;
+                if (addHit(hits, k) < 0 || addHit(hits, rec) < 0)
+                    return -1;
+            }
+        }
+
+        if (i + 1 == len)
+            break;
+        for (k = set->byPair[pairBucket(f[i], f[i + 1])]; k >= 0;
+                k = set->next[k]) {
+            if (seen[k] != rec && set->keyLens[k] <= len - i
+                    && memcmp(f + i, set->keys[k], set->keyLens[k]) == 0) {
+                seen[k] = rec;
+                if (addHit(hits, k) < 0 || addHit(hits, rec) < 0)
+                    return -1;
+            }
+        }
+    }
+    return 0;
 }
 
-void freemdb(struct List *list) 
+int scanmdbKeys(const struct MdbStore *db, int from, int to,
+        const struct MdbKeySet *set, struct MdbHits *hits)
 {
-    // free all the records
-    traverseList(list, &free);
-    removeAllNodes(list);
+    int *seen = (int *)malloc(set->nkeys * sizeof(int));
+    if (seen == NULL && set->nkeys > 0)
+        return -1;
+
+    // the last record each key matched
+    int k;
+    for (k = 0; k < set->nkeys; k++)
+        seen[k] = -1;
+
+    int err = 0;
+    int i;
+    for (i = from; i < to && err == 0; i++) {
+        const struct MdbRec *rec = &db->recs[i];
+
+        for (k = set->empty; k >= 0 && err == 0; k = set->next[k]) {
+            if (addHit(hits, k) < 0 || addHit(hits, i) < 0)
+                err = -1;
+        }
+        if (err == 0)
+            err = matchField(set, rec->name, sizeof(rec->name), i, seen, hits);
+        if (err == 0)
+            err = matchField(set, rec->msg, sizeof(rec->msg), i, seen, hits);
+    }
+    free(seen);
+    return err;
 }
@@ -5,9 +5,171 @@
 #ifndef _MDB_H_
 #define _MDB_H_
 
+#include <stddef.h>
+
 struct MdbRec {
     char name[16];
     char  msg[24];
 };
 
+/*
+ * An in-memory view of a database file, or of a shard of it: 'count'
+ * records laid out contiguously at 'recs', exactly as they are stored
+ * on disk.  recs[0] is record 'first' of the file (counting from 0), so
+ * recs[i] is record number first + i + 1.
+ *
+ * The file is mapped read-only and shared, so the records are never
+ * copied and the page cache is shared with every other process that
+ * has the same file open.  Only the records within the size the file
+ * had when it was loaded are ever read, so appending to a file that is
+ * being served is safe.  Anything else must be done by writing a new
+ * file and rename()ing it into place: the mapping follows the file, so
+ * rewriting it in place changes records under readers, and truncating
+ * it makes reading the records past the new end fault (SIGBUS).  The
+ * snapshots notice the new inode and load the new file.
+ */
+struct MdbStore {
+    const struct MdbRec *recs;
+    int count;
+    int first;
+
+    void *map;          // from the page boundary before recs; NULL if empty
+    size_t mapLen;
+};
+
+/*
+ * Map the database file open on 'fd' into 'db': records 'first' (from
+ * 0) up to 'first + max', or up to the end of the file if max is -1.
+ * A trailing partial record, if any, is ignored.  The caller may close
+ * 'fd' afterwards.
+ *
+ * Returns the number of records, or -1 on failure.
+ */
+int loadmdb(int fd, struct MdbStore *db, int first, int max);
+
+/*
+ * Unmap the database loaded by loadmdb().
+ */
+void freemdb(struct MdbStore *db);
+
+/*
+ * Returns 1 if 'key' occurs in the name or the msg of 'rec', 0
+ * otherwise.  This is the definition of a match used by every lookup
+ * path.  It is equivalent to
+ *
+ *     strstr(rec->name, key) || strstr(rec->msg, key)
+ *
+ * except that a field is never read past its end even if it is not
+ * NUL-terminated.
+ */
+int mdbRecMatches(const struct MdbRec *rec, const char *key, size_t keyLen);
+
+/*
+ * Bounded strstr(): returns 1 if 'key' (of length keyLen > 0) occurs in
+ * the NUL-terminated string stored in 'field', which is at most 'cap'
+ * bytes long, 0 otherwise.
+ */
+int mdbFieldContains(const char *field, size_t cap,
+        const char *key, size_t keyLen);
+
+/*
+ * The result of a lookup: the indexes (0-based, i.e., record number
+ * minus one) of the matching records, in ascending order.
+ */
+struct MdbHits {
+    int *recs;
+    int count;
+    int cap;
+};
+
+static inline void initHits(struct MdbHits *hits)
+{
+    hits->recs = 0;
+    hits->count = 0;
+    hits->cap = 0;
+}
+
+/*
+ * Append a record index to 'hits'.
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int addHit(struct MdbHits *hits, int rec);
+
+/*
+ * Free the memory held by 'hits' and make it empty again.
+ */
+void freeHits(struct MdbHits *hits);
+
+/*
+ * Find the records matching 'key' by testing every record of 'db' with
+ * mdbRecMatches(), and append them to 'hits'.
+ *
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int scanmdb(const struct MdbStore *db, const char *key, size_t keyLen,
+        struct MdbHits *hits);
+
+/*
+ * Same as scanmdb(), but only looks at records 'from' up to (not
+ * including) 'to'.
+ */
+int scanmdbRange(const struct MdbStore *db, int from, int to,
+        const char *key, size_t keyLen, struct MdbHits *hits);
+
+// buckets of the table of multi-character keys in a MdbKeySet
+#define KeyPairBuckets 1024
+
+/*
+ * A set of keys to be looked for in each record all at once.  Every
+ * position of a field is checked only against the keys that start
+ * with the characters found there, through a table on their first
+ * one or two characters, so a record is read once however many keys
+ * there are.
+ */
+struct MdbKeySet {
+    const char *const *keys;
+    const size_t *keyLens;
+    int nkeys;
+
+    // heads of lists of key indexes chained through 'next', -1 if empty
+    int empty;                      // keys matching every record
+    int byChar[256];                // one-character keys
+    int byPair[KeyPairBuckets];     // longer keys, by their first two
+    int *next;
+};
+
+/*
+ * Build the set of the 'nkeys' keys keys[0] to keys[nkeys - 1].  The
+ * set refers to the keys, which must outlive it.
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int initKeySet(struct MdbKeySet *set, int nkeys,
+        const char *const keys[], const size_t keyLens[]);
+
+/*
+ * Free the memory held by a set built by initKeySet().
+ */
+void freeKeySet(struct MdbKeySet *set);
+
+/*
+ * Look for all the keys of 'set' in records 'from' up to (not
+ * including) 'to' of 'db' in one pass.  For every key matching a record
+ * (in the sense of mdbRecMatches()), the key index and then the record
+ * index are appended to 'hits'.  The pairs of each key are in record
+ * order.
+ *
+ * Returns 0 on success and -1 if memory could not be allocated.
+ */
+int scanmdbKeys(const struct MdbStore *db, int from, int to,
+        const struct MdbKeySet *set, struct MdbHits *hits);
+
+/*
+ * Format string and arguments for printing a matching record in the
+ * lookup protocol.  The field widths keep printf() inside the record.
+ */
+#define MDB_REC_FMT "%4d: {%.*s} said {%.*s}\n"
+#define MDB_REC_ARGS(recNo, rec) \
+    (recNo), (int)sizeof((rec)->name), (rec)->name, \
+             (int)sizeof((rec)->msg), (rec)->msg
+
 #endif /* _MDB_H_ */